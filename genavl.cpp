@@ -18,186 +18,154 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "genavl.h"
+#include "genavl_tree.h"
 
-/***********************************************
- *
- * The GenAVLStackEntry is a private structure
- * used to keep track of the path to a
- * GenAVLEntry which is to be removed from the
- * tree. This path is useful in rebalancing the
- * tree after the entry has been removed.
- *
- ***********************************************/
-typedef struct {
-  GenAVLEntry* e;
-  int d;
-} GenAVLStackEntry;
-
-/**************************************************
- * Sets the referenced child to be either the left
- * or right child of the given entry. Used
- * internally to make implementation simpler.
- **************************************************/
-static void set(GenAVLTree* gatp,
-                GenAVLEntry* gaep,
-                int dir,
-                GenAVLEntry* gaepnext) {
-  if (gaep) {
-    if (dir < 0)
-      gaep->left = gaepnext;
-    else
-      gaep->right = gaepnext;
-  } else
-    gatp->root = gaepnext;
-}
+using genavl::detail::c_policy;
 
-/**************************************************
- * Returns a pointer to the specified GenAVLEntry
- * given via a pointer to the parent and a
- * direction. Used internally to make the
- * implementation simpler.
- **************************************************/
-static GenAVLEntry* val(GenAVLTree* gatp, GenAVLEntry* gaep, int dir) {
-  if (gaep)
-    return dir < 0 ? gaep->left : gaep->right;
-  else
-    return gatp->root;
-}
+#if defined(__GNUC__)
+#define GENAVL_PREFETCH(a) __builtin_prefetch(a)
+#else
+#define GENAVL_PREFETCH(a) ((void)0)
+#endif
 
-/***********************************************************
+/*******************************************************
  *
- * Shift the children of the given entry from left to right
- * where the imbalance extends one additional level.
+ * Initialize the AVL Entry
  *
- ***********************************************************/
-static void shiftdblright(GenAVLTree* gatp, GenAVLEntry* gaep, int dir) {
-  GenAVLEntry* gaepnext;
-  GenAVLEntry* gaepnextl;
-  GenAVLEntry* gaepnextr;
-
-  gaepnext = val(gatp, gaep, dir);
-  gaepnextl = gaepnext->left;
-  gaepnextr = gaepnextl->right;
-
-  gaepnextl->right = gaepnextr->left;
-  gaepnext->left = gaepnextr->right;
-  gaepnextr->left = gaepnextl;
-  gaepnextr->right = gaepnext;
-
-  if (gaepnextr->balance == -1) {
-    gaepnextl->balance = 0;
-    gaepnext->balance = 1;
-  } else {
-    if (gaepnextr->balance == 1) {
-      gaepnextl->balance = -1;
-      gaepnext->balance = 0;
-    } else {
-      gaepnextl->balance = 0;
-      gaepnext->balance = 0;
-    }
-  }
-  gaepnextr->balance = 0;
-  set(gatp, gaep, dir, gaepnextr);
+ *******************************************************/
+void GenAVLInit(GenAVLEntry* e, void* d) {
+  e->balance = 0;
+#if defined(USE_GENAVL_COUNT)
+  e->count = 1;
+#endif
+#if defined(USE_GENAVL_PARENT)
+  e->parent = 0;
+#endif
+#if defined(USE_GENAVL_PREFIX)
+  e->prefix = 0;
+#endif
+  e->right = 0;
+  e->left = 0;
+  e->data = d;
 }
 
-/***********************************************************
+/*******************************************************
  *
- * Shift the children of the given entry from left to right
- * where the imbalance is only a single level.
+ * Initialize an empty tree with the given Compare and
+ * Key methods and the optional methods all 0
  *
- ***********************************************************/
-static void shiftright(GenAVLTree* gatp, GenAVLEntry* gaep, int dir) {
-  GenAVLEntry* gaepnext;
-  GenAVLEntry* gaepnextl;
-
-  gaepnext = val(gatp, gaep, dir);
-  gaepnextl = gaepnext->left;
-
-  gaepnext->left = gaepnextl->right;
-  gaepnextl->right = gaepnext;
-  set(gatp, gaep, dir, gaepnextl);
-
-  if (gaepnextl->balance == -1) {
-    gaepnextl->balance = 0;
-    gaepnext->balance = 0;
-  } else {
-    gaepnextl->balance = 1;
-    gaepnext->balance = -1;
-  }
+ *******************************************************/
+void GenAVLTreeInit(GenAVLTree* gatp,
+                    int (*Compare)(GenAVLEntry*, const void*),
+                    void* (*Key)(GenAVLEntry*)) {
+  gatp->root = 0;
+  gatp->Compare = Compare;
+  gatp->Key = Key;
+  gatp->KeyIncrement = 0;
+  gatp->KeyCompare = 0;
+#if defined(USE_GENAVL_AUGMENT)
+  gatp->Augment = 0;
+#endif
+#if defined(USE_GENAVL_PREFIX)
+  gatp->Prefix = 0;
+#endif
 }
 
-/***********************************************************
+/*******************************************************
  *
- * Shift the children of the given entry from right to left
- * where the imbalance is two levels deep.
+ * Steps the breadth-first walk back up one level,
+ * recovering the parent's height from the child's
  *
- ***********************************************************/
-static void shiftdblleft(GenAVLTree* gatp, GenAVLEntry* gaep, int dir) {
-  GenAVLEntry* gaepnext;
-  GenAVLEntry* gaepnextl;
-  GenAVLEntry* gaepnextr;
-
-  gaepnext = val(gatp, gaep, dir);
-  gaepnextr = gaepnext->right;
-  gaepnextl = gaepnextr->left;
-
-  gaepnext->right = gaepnextl->left;
-  gaepnextr->left = gaepnextl->right;
-  gaepnextl->left = gaepnext;
-  gaepnextl->right = gaepnextr;
-
-  if (gaepnextl->balance == -1) {
-    gaepnext->balance = 0;
-    gaepnextr->balance = 1;
-  } else {
-    if (gaepnextl->balance == 1) {
-      gaepnext->balance = -1;
-      gaepnextr->balance = 0;
-    } else {
-      gaepnext->balance = 0;
-      gaepnextr->balance = 0;
-    }
-  }
-  gaepnextl->balance = 0;
-  set(gatp, gaep, dir, gaepnextl);
+ *******************************************************/
+static void GenAVLBFIterPop(GenAVLBFIter* gabfip) {
+  GenAVLEntry* gaep;
+
+  if (--gabfip->sp < 0)
+    return;
+  gaep = gabfip->es[gabfip->sp];
+  if (gabfip->dir[gabfip->sp] == 1)
+    gabfip->ht += 1 + (gaep->balance > 0);
+  else
+    gabfip->ht += 1 + (gaep->balance < 0);
 }
 
-/***********************************************************
+/*******************************************************
  *
- * Shift the children of the given entry from right to left
- * where the imbalance is only a single level.
+ * Walks depth-first to the next node on the level
+ * being visited, moving on to the next level when
+ * this one is done. es[] holds the path and dir[] the
+ * next child to try at each depth: 0 for left, 1 for
+ * right and 2 when both are done. ht is the height of
+ * the node on top, which rules out subtrees that do
+ * not reach down to the level
  *
- ***********************************************************/
-static void shiftleft(GenAVLTree* gatp, GenAVLEntry* gaep, int dir) {
-  GenAVLEntry* gaepnext;
-  GenAVLEntry* gaepnextr;
+ *******************************************************/
+static void* GenAVLBFIterSeek(GenAVLBFIter* gabfip) {
+  GenAVLEntry* gaep;
+  GenAVLEntry* child;
+  int h;
+
+  while (gabfip->maxdepth < gabfip->levels) {
+    if (gabfip->sp < 0) {
+      if (++gabfip->maxdepth >= gabfip->levels)
+        break;
+      gabfip->sp = 0;
+      gabfip->es[0] = gabfip->root;
+      gabfip->dir[0] = 0;
+      gabfip->ht = gabfip->height;
+      continue;
+    }
 
-  gaepnext = val(gatp, gaep, dir);
-  gaepnextr = gaepnext->right;
+    gaep = gabfip->es[gabfip->sp];
+    if (gabfip->sp == gabfip->maxdepth) {
+      GenAVLBFIterPop(gabfip);
+      return gaep->data;
+    }
 
-  gaepnext->right = gaepnextr->left;
-  gaepnextr->left = gaepnext;
-  set(gatp, gaep, dir, gaepnextr);
+    if (gabfip->dir[gabfip->sp] == 0) {
+      gabfip->dir[gabfip->sp] = 1;
+      child = gaep->left;
+      h = gabfip->ht - 1 - (gaep->balance > 0);
+    } else if (gabfip->dir[gabfip->sp] == 1) {
+      gabfip->dir[gabfip->sp] = 2;
+      child = gaep->right;
+      h = gabfip->ht - 1 - (gaep->balance < 0);
+    } else {
+      GenAVLBFIterPop(gabfip);
+      continue;
+    }
 
-  if (gaepnextr->balance == 1) {
-    gaepnextr->balance = 0;
-    gaepnext->balance = 0;
-  } else {
-    gaepnextr->balance = -1;
-    gaepnext->balance = 1;
+    if (child && gabfip->sp + h >= gabfip->maxdepth) {
+      gabfip->es[++gabfip->sp] = child;
+      gabfip->dir[gabfip->sp] = 0;
+      gabfip->ht = h;
+    }
   }
+  return 0;
 }
 
 /*******************************************************
  *
- * Initialize the AVL Entry
+ * Begins a traversal of the top levels of the tree in
+ * breadth-first order. Returns 0 if the tree is empty
+ * or the data pointer of the root, otherwise
  *
  *******************************************************/
-void GenAVLInit(GenAVLEntry* e, void* d) {
-  e->balance = 0;
-  e->right = 0;
-  e->left = 0;
-  e->data = d;
+void* GenAVLBFIterInitLevelsData(GenAVLBFIter* gabfip,
+                                 GenAVLTree* gatp,
+                                 int levels) {
+  GenAVLEntry* gaep;
+
+  gabfip->root = gatp->root;
+  gabfip->height = 0;
+  for (gaep = gatp->root; gaep;
+       gaep = gaep->balance > 0 ? gaep->right : gaep->left)
+    gabfip->height++;
+
+  gabfip->levels = levels < gabfip->height ? levels : gabfip->height;
+  gabfip->maxdepth = -1;
+  gabfip->sp = -1;
+  return GenAVLBFIterSeek(gabfip);
 }
 
 /*******************************************************
@@ -208,7 +176,7 @@ void GenAVLInit(GenAVLEntry* e, void* d) {
  *
  *******************************************************/
 void* GenAVLBFIterInitData(GenAVLBFIter* gabfip, GenAVLTree* gatp) {
-  return 0;
+  return GenAVLBFIterInitLevelsData(gabfip, gatp, MAX_GENAVL_STACK);
 }
 
 /*******************************************************
@@ -219,7 +187,7 @@ void* GenAVLBFIterInitData(GenAVLBFIter* gabfip, GenAVLTree* gatp) {
  *
  *******************************************************/
 void* GenAVLBFIterNextData(GenAVLBFIter* gabfip) {
-  return 0;
+  return GenAVLBFIterSeek(gabfip);
 }
 
 /*******************************************************
@@ -280,7 +248,9 @@ void* GenAVLLFIterNextData(GenAVLLFIter* gadlip, GenAVLTree* gatp) {
   /* Remove element from the tree (tree is unbalanced) */
   if (gadlip->sp) {
     pgaep = gadlip->stack[gadlip->sp - 1];
-    if (gatp->Compare(gaep, gatp->Key(pgaep)) > 0) {
+    /* The parent still links to the element, which    */
+    /* tells us which side it was on without comparing */
+    if (pgaep->right == gaep) {
       gaep->right = pgaep;
       pgaep->right = 0;
     } else {
@@ -313,58 +283,109 @@ void* GenAVLLFIterNextData(GenAVLLFIter* gadlip, GenAVLTree* gatp) {
  *******************************************************/
 void GenAVLLLFIterReplace(GenAVLTree* gatp, GenAVLEntry* gaep) {
   if (gaep->left) {
+#if defined(USE_GENAVL_PARENT)
+    gaep->parent = gaep->left;
+#endif
     gaep->left->left = gaep;
     gaep->left = 0;
   } else {
     if (gaep->right) {
+#if defined(USE_GENAVL_PARENT)
+      gaep->parent = gaep->right;
+#endif
       gaep->right->right = gaep;
       gaep->right = 0;
-    } else
+    } else {
+#if defined(USE_GENAVL_PARENT)
+      gaep->parent = 0;
+#endif
       gatp->root = gaep;
+    }
   }
 }
 
 /*******************************************************
  *
- * Traverses to the left-most element, pushing all
- * nodes onto the stack and returns the data pointer
- * of the left-most element or 0 if there are no such
+ * Pushes the path to the left-most element greater
+ * than (or, if equal is set, greater than or equal to)
+ * the key onto the stack, or to the left-most element
+ * of the tree if the key is 0
  *
  *******************************************************/
-void* GenAVLDFIterInitData(GenAVLDFIter* gadfip, GenAVLTree* gatp) {
+static void GenAVLDFIterPushNext(GenAVLDFIter* gadfip,
+                                 GenAVLTree* gatp,
+                                 const void* key,
+                                 int equal) {
+  c_policy p(gatp);
+  c_policy::key_type k = p.make_key(key);
   GenAVLEntry* gaep;
+  int dir;
 
   gadfip->sp = 0;
   gaep = gatp->root;
   while (gaep) {
-    gadfip->stack[gadfip->sp++] = gaep;
-    gaep = gaep->left;
+    dir = key ? p.compare(gaep, k) : 1;
+    if (dir > 0 || (dir == 0 && equal)) {
+      gadfip->stack[gadfip->sp++] = gaep;
+      gaep = gaep->left;
+    } else
+      gaep = gaep->right;
   }
-  return GenAVLDFIterNextData(gadfip);
 }
 
 /*******************************************************
  *
- * Traverses to the left-most element lexicographically
- * greater than or equal to the element given by the key,
- * pushing all nodes onto the stack and returns the data
- * pointer of the element or 0 if there are no such
+ * Pushes the path to the right-most element less than
+ * (or, if equal is set, less than or equal to) the key
+ * onto the stack, or to the right-most element of the
+ * tree if the key is 0
  *
  *******************************************************/
-void* GenAVLDFIterInitNextEqualData(GenAVLDFIter* gadfip,
-                                    GenAVLTree* gatp,
-                                    const void* key) {
+static void GenAVLDFIterPushPrev(GenAVLDFIter* gadfip,
+                                 GenAVLTree* gatp,
+                                 const void* key,
+                                 int equal) {
+  c_policy p(gatp);
+  c_policy::key_type k = p.make_key(key);
   GenAVLEntry* gaep;
+  int dir;
 
   gadfip->sp = 0;
   gaep = gatp->root;
   while (gaep) {
-    if (gatp->Compare(gaep, key) >= 0) {
+    dir = key ? p.compare(gaep, k) : -1;
+    if (dir < 0 || (dir == 0 && equal)) {
       gadfip->stack[gadfip->sp++] = gaep;
-      gaep = gaep->left;
-    } else
       gaep = gaep->right;
+    } else
+      gaep = gaep->left;
   }
+}
+
+/*******************************************************
+ *
+ * Traverses to the left-most element, pushing all
+ * nodes onto the stack and returns the data pointer
+ * of the left-most element or 0 if there are no such
+ *
+ *******************************************************/
+void* GenAVLDFIterInitData(GenAVLDFIter* gadfip, GenAVLTree* gatp) {
+  GenAVLDFIterPushNext(gadfip, gatp, 0, 0);
+  return GenAVLDFIterNextData(gadfip);
+}
+
+/*******************************************************
+ *
+ * Traverses to the left-most element lexicographically
+ * greater than or equal to the element given by the key,
+ * pushing all nodes onto the stack and returns the data
+ * pointer of the element or 0 if there are no such
+ *
+ *******************************************************/
+void* GenAVLDFIterInitNextEqualData(GenAVLDFIter* gadfip,
+                                    GenAVLTree* gatp,
+                                    const void* key) {
+  GenAVLDFIterPushNext(gadfip, gatp, key, 1);
   return GenAVLDFIterNextData(gadfip);
 }
 
@@ -379,20 +400,52 @@ void* GenAVLDFIterInitNextEqualData(GenAVLDFIter* gadfip,
 void* GenAVLDFIterInitNextData(GenAVLDFIter* gadfip,
                                GenAVLTree* gatp,
                                const void* key) {
-  GenAVLEntry* gaep;
-
-  gadfip->sp = 0;
-  gaep = gatp->root;
-  while (gaep) {
-    if (gatp->Compare(gaep, key) > 0) {
-      gadfip->stack[gadfip->sp++] = gaep;
-      gaep = gaep->left;
-    } else
-      gaep = gaep->right;
-  }
+  GenAVLDFIterPushNext(gadfip, gatp, key, 0);
   return GenAVLDFIterNextData(gadfip);
 }
 
+/*******************************************************
+ *
+ * Traverses to the right-most element, pushing all
+ * nodes onto the stack and returns the data pointer
+ * of the right-most element or 0 if there are no such
+ *
+ *******************************************************/
+void* GenAVLDFIterInitLastData(GenAVLDFIter* gadfip, GenAVLTree* gatp) {
+  GenAVLDFIterPushPrev(gadfip, gatp, 0, 0);
+  return GenAVLDFIterPrevData(gadfip);
+}
+
+/*******************************************************
+ *
+ * Traverses to the right-most element lexicographically
+ * less than or equal to the element given by the key,
+ * pushing all nodes onto the stack and returns the data
+ * pointer of the element or 0 if there are no such
+ *
+ *******************************************************/
+void* GenAVLDFIterInitPrevEqualData(GenAVLDFIter* gadfip,
+                                    GenAVLTree* gatp,
+                                    const void* key) {
+  GenAVLDFIterPushPrev(gadfip, gatp, key, 1);
+  return GenAVLDFIterPrevData(gadfip);
+}
+
+/*******************************************************
+ *
+ * Traverses to the right-most element lexicographically
+ * less than the element given by the key, pushing all
+ * nodes onto the stack and returns the data pointer of
+ * the element or 0 if there are no such
+ *
+ *******************************************************/
+void* GenAVLDFIterInitPrevData(GenAVLDFIter* gadfip,
+                               GenAVLTree* gatp,
+                               const void* key) {
+  GenAVLDFIterPushPrev(gadfip, gatp, key, 0);
+  return GenAVLDFIterPrevData(gadfip);
+}
+
 /*******************************************************
  *
  * Traverses to the next node from the top-most entry
@@ -425,6 +478,183 @@ void* GenAVLDFIterNextData(GenAVLDFIter* gadfip) {
   return dp;
 }
 
+/*******************************************************
+ *
+ * Traverses to the previous node from the top-most
+ * entry in the stack and pops the stack, then traverses
+ * to right most entry pushing onto the stack
+ *
+ *******************************************************/
+void* GenAVLDFIterPrevData(GenAVLDFIter* gadfip) {
+  GenAVLEntry* gaep;
+  void* dp;
+
+  /* If the stack is empty we've already visited all   */
+  if (gadfip->sp == 0)
+    return 0;
+
+  /* Pop the stack to get the last visited element     */
+  gaep = gadfip->stack[--gadfip->sp];
+  dp = gaep->data;
+
+  /* For the node to the left, push all the right nodes*/
+  if (gaep->left) {
+    gaep = gaep->left;
+    while (gaep) {
+      gadfip->stack[gadfip->sp++] = gaep;
+      gaep = gaep->right;
+    }
+  }
+
+  /* Return the data pointer of the last visited node  */
+  return dp;
+}
+
+/*******************************************************
+ *
+ * Begins an iteration over the elements from lo to hi,
+ * either of which may be 0 for no bound, with flags
+ * giving the direction and whether each bound is
+ * included. Returns the data pointer of the first
+ * element or 0 if there are none
+ *
+ *******************************************************/
+void* GenAVLRangeIterInitData(GenAVLRangeIter* garip,
+                              GenAVLTree* gatp,
+                              const void* lo,
+                              const void* hi,
+                              int flags) {
+  garip->gatp = gatp;
+  garip->flags = flags;
+  if (flags & GENAVL_RANGE_REVERSE) {
+    garip->end = lo;
+    GenAVLDFIterPushPrev(&garip->df, gatp, hi, flags & GENAVL_RANGE_HI_INCL);
+  } else {
+    garip->end = hi;
+    GenAVLDFIterPushNext(&garip->df, gatp, lo, flags & GENAVL_RANGE_LO_INCL);
+  }
+  return GenAVLRangeIterNextData(garip);
+}
+
+/*******************************************************
+ *
+ * Continues a range iteration. Returns the data pointer
+ * of the next element or 0 once the far bound has been
+ * passed
+ *
+ *******************************************************/
+void* GenAVLRangeIterNextData(GenAVLRangeIter* garip) {
+  GenAVLDFIter* gadfip = &garip->df;
+  int dir;
+
+  if (gadfip->sp == 0)
+    return 0;
+
+  /* Check the next element against the far bound      */
+  /* before it is popped                               */
+  if (garip->end) {
+    dir = garip->gatp->Compare(gadfip->stack[gadfip->sp - 1], garip->end);
+    if (garip->flags & GENAVL_RANGE_REVERSE) {
+      if (dir < 0 || (dir == 0 && !(garip->flags & GENAVL_RANGE_LO_INCL)))
+        gadfip->sp = 0;
+    } else {
+      if (dir > 0 || (dir == 0 && !(garip->flags & GENAVL_RANGE_HI_INCL)))
+        gadfip->sp = 0;
+    }
+  }
+
+  if (garip->flags & GENAVL_RANGE_REVERSE)
+    return GenAVLDFIterPrevData(gadfip);
+  return GenAVLDFIterNextData(gadfip);
+}
+
+#if defined(USE_GENAVL_AUGMENT)
+/*******************************************************
+ *
+ * Pushes the given node and its left descendants onto
+ * the interval iterator's stack, stopping at the first
+ * subtree in which no interval ends past the query's
+ * lower bound
+ *
+ *******************************************************/
+static void GenAVLIVIterPushLeft(GenAVLIVIter* gaivip, GenAVLEntry* gaep) {
+  GenAVLIntervalTree* ivtp = gaivip->ivtp;
+
+  while (gaep && ivtp->MaxEndCompare(gaep, gaivip->lo) > 0) {
+    gaivip->stack[gaivip->sp++] = gaep;
+    gaep = gaep->left;
+  }
+}
+
+/*******************************************************
+ *
+ * Begins an iteration over the intervals containing
+ * the given point. Returns the data pointer of the
+ * first or 0 if there are none
+ *
+ *******************************************************/
+void* GenAVLIVIterInitStabData(GenAVLIVIter* gaivip,
+                               GenAVLIntervalTree* ivtp,
+                               const void* point) {
+  gaivip->sp = 0;
+  gaivip->ivtp = ivtp;
+  gaivip->lo = point;
+  gaivip->hi = point;
+  gaivip->stab = 1;
+  GenAVLIVIterPushLeft(gaivip, ivtp->tree.root);
+  return GenAVLIVIterNextData(gaivip);
+}
+
+/*******************************************************
+ *
+ * Begins an iteration over the intervals overlapping
+ * [lo, hi). Returns the data pointer of the first or 0
+ * if there are none
+ *
+ *******************************************************/
+void* GenAVLIVIterInitOverlapData(GenAVLIVIter* gaivip,
+                                  GenAVLIntervalTree* ivtp,
+                                  const void* lo,
+                                  const void* hi) {
+  gaivip->sp = 0;
+  gaivip->ivtp = ivtp;
+  gaivip->lo = lo;
+  gaivip->hi = hi;
+  gaivip->stab = 0;
+  GenAVLIVIterPushLeft(gaivip, ivtp->tree.root);
+  return GenAVLIVIterNextData(gaivip);
+}
+
+/*******************************************************
+ *
+ * Continues an interval iteration, in start order.
+ * Returns the data pointer of the next matching
+ * interval or 0 when there are no more
+ *
+ *******************************************************/
+void* GenAVLIVIterNextData(GenAVLIVIter* gaivip) {
+  GenAVLIntervalTree* ivtp = gaivip->ivtp;
+  GenAVLEntry* gaep;
+  int dir;
+
+  while (gaivip->sp) {
+    gaep = gaivip->stack[--gaivip->sp];
+
+    /* Everything from here on starts too late        */
+    dir = ivtp->tree.Compare(gaep, gaivip->hi);
+    if (dir > 0 || (dir == 0 && !gaivip->stab)) {
+      gaivip->sp = 0;
+      break;
+    }
+
+    GenAVLIVIterPushLeft(gaivip, gaep->right);
+    if (ivtp->EndCompare(gaep, gaivip->lo) > 0)
+      return gaep->data;
+  }
+  return 0;
+}
+#endif
+
 /*******************************************************
  *
  * Finds the next free key value - if the value is found
@@ -503,31 +733,559 @@ int GenAVLTreeNextFreeKey(GenAVLTree* gatp, const void* start, void* next) {
   }
 }
 
+#if defined(USE_GENAVL_PREFIX)
 /*******************************************************
  *
- * Find and return a pointer to the entry given by the
- * key data. Return 0 if no such entry is in the tree.
+ * Returns the first 8 bytes of the n given bytes as a
+ * big-endian number, padded with zeros, so prefixes
+ * order in the same way as memcmp on the bytes
  *
  *******************************************************/
-GenAVLEntry* GenAVLTreeFind(GenAVLTree* gatp, const void* key) {
-  GenAVLEntry* gaep;
-  int dir;
+uint64_t GenAVLPrefixBytes(const void* key, size_t n) {
+  const unsigned char* cp = (const unsigned char*)key;
+  uint64_t prefix = 0;
+  size_t i;
+
+  for (i = 0; i < 8; i++)
+    prefix = (prefix << 8) | (i < n ? cp[i] : 0);
+  return prefix;
+}
+#endif
 
-  for (gaep = gatp->root; gaep;) {
-    if ((dir = gatp->Compare(gaep, key)) > 0)
-      gaep = gaep->left;
-    else {
-      if (dir < 0)
-        gaep = gaep->right;
-      else
-        return gaep;
-    }
-  }
+/*******************************************************
+ *
+ * Sources which hand the entries to the tree builder
+ * one at a time, in order
+ *
+ *******************************************************/
+struct GenAVLArraySource {
+  GenAVLEntry** entries;
 
-  return 0;
-}
-void* GenAVLTreeFindData(GenAVLTree* gatp, const void* key) {
-  GenAVLEntry* gaep;
+  GenAVLEntry* operator()() { return *entries++; }
+};
+
+struct GenAVLStreamSource {
+  GenAVLEntry* (*next)(void*);
+  void* ctx;
+
+  GenAVLEntry* operator()() { return next(ctx); }
+};
+
+/*******************************************************
+ *
+ * Replace the tree with a balanced tree built from the
+ * given entries, which are in ascending key order
+ *
+ *******************************************************/
+void GenAVLTreeBuildSorted(GenAVLTree* gatp,
+                           GenAVLEntry** entries,
+                           size_t n) {
+  c_policy p(gatp);
+  GenAVLArraySource src = {entries};
+
+  genavl::detail::build_sorted(p, n, src);
+}
+
+/*******************************************************
+ *
+ * Replace the tree with a balanced tree built from n
+ * entries pulled in ascending key order from next
+ *
+ *******************************************************/
+void GenAVLTreeBuildStream(GenAVLTree* gatp,
+                           size_t n,
+                           GenAVLEntry* (*next)(void*),
+                           void* ctx) {
+  c_policy p(gatp);
+  GenAVLStreamSource src = {next, ctx};
+
+  genavl::detail::build_sorted(p, n, src);
+}
+
+/*******************************************************
+ *
+ * Add a batch of entries, merging it with the tree in a
+ * single pass where that is cheaper. added[i] reports
+ * whether entries[i] was added.
+ *
+ *******************************************************/
+size_t GenAVLTreeAddBatch(GenAVLTree* gatp,
+                          GenAVLEntry** entries,
+                          size_t n,
+                          int sorted,
+                          int* added) {
+  c_policy p(gatp);
+
+  return genavl::detail::add_batch(p, entries, n, sorted, added);
+}
+
+#if defined(USE_GENAVL_COUNT)
+/*******************************************************
+ *
+ * Return the number of entries in the tree
+ *
+ *******************************************************/
+size_t GenAVLTreeCount(GenAVLTree* gatp) {
+  return gatp->root ? gatp->root->count : 0;
+}
+
+/*******************************************************
+ *
+ * Return the number of entries less than the key
+ *
+ *******************************************************/
+size_t GenAVLTreeRank(GenAVLTree* gatp, const void* key) {
+  c_policy p(gatp);
+
+  return genavl::detail::rank(p, p.make_key(key), 0);
+}
+
+/*******************************************************
+ *
+ * Return the entry at the given position in key order
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLTreeSelect(GenAVLTree* gatp, size_t i) {
+  c_policy p(gatp);
+
+  return genavl::detail::select(p, i);
+}
+
+/*******************************************************
+ *
+ * Return the number of entries from lo to hi inclusive
+ *
+ *******************************************************/
+size_t GenAVLTreeCountRange(GenAVLTree* gatp,
+                            const void* lo,
+                            const void* hi) {
+  c_policy p(gatp);
+  size_t below;
+  size_t upto;
+
+  below = genavl::detail::rank(p, p.make_key(lo), 0);
+  upto = genavl::detail::rank(p, p.make_key(hi), 1);
+  return upto > below ? upto - below : 0;
+}
+#endif
+
+#if defined(USE_GENAVL_AUGMENT)
+/*******************************************************
+ *
+ * Passes the pieces of a range on to the caller's fold
+ *
+ *******************************************************/
+struct GenAVLFold {
+  void (*fold)(void*, GenAVLEntry*, int);
+  void* acc;
+
+  void operator()(GenAVLEntry* gaep, int subtree) { fold(acc, gaep, subtree); }
+};
+
+/*******************************************************
+ *
+ * Fold the entries from lo to hi inclusive into acc,
+ * using the values kept by Augment for whole subtrees
+ *
+ *******************************************************/
+void GenAVLTreeAggregateRange(GenAVLTree* gatp,
+                              const void* lo,
+                              const void* hi,
+                              void (*fold)(void*, GenAVLEntry*, int),
+                              void* acc) {
+  c_policy p(gatp);
+  GenAVLFold f = {fold, acc};
+  c_policy::key_type klo = p.make_key(lo);
+  c_policy::key_type khi = p.make_key(hi);
+
+  genavl::detail::aggregate_range(p, lo ? &klo : 0, hi ? &khi : 0, f);
+}
+
+/*******************************************************
+ *
+ * Recompute the Augment values on the path to the
+ * entry with the given key, after its value changed
+ *
+ *******************************************************/
+int GenAVLTreeReaugment(GenAVLTree* gatp, const void* key) {
+  c_policy p(gatp);
+
+  return genavl::detail::fix_path(p, p.make_key(key));
+}
+#endif
+
+/*******************************************************
+ *
+ * Append the middle entry and the right tree to the
+ * left tree, leaving the right tree empty
+ *
+ *******************************************************/
+void GenAVLTreeJoin(GenAVLTree* gatp, GenAVLEntry* gae, GenAVLTree* gatpr) {
+  c_policy p(gatp);
+
+  if (gae)
+    p.set_root(genavl::detail::join(p, gatp->root, gae, gatpr->root));
+  else
+    p.set_root(genavl::detail::join2(p, gatp->root, gatpr->root));
+  gatpr->root = 0;
+}
+
+/*******************************************************
+ *
+ * Move the entries greater than the key to the right
+ * tree, returning the entry equal to the key, if any
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLTreeSplit(GenAVLTree* gatp,
+                             const void* key,
+                             GenAVLTree* gatpr) {
+  c_policy p(gatp);
+  GenAVLEntry* gaepl;
+  GenAVLEntry* gaepr;
+  GenAVLEntry* gaep;
+
+  gaep = genavl::detail::split(p, gatp->root.get(), p.make_key(key), &gaepl, &gaepr);
+  p.set_root(gaepl);
+  c_policy(gatpr).set_root(gaepr);
+  if (gaep)
+    p.init(gaep);
+  return gaep;
+}
+
+/*******************************************************
+ *
+ * Move the entries of src with keys not in dst to dst
+ *
+ *******************************************************/
+void GenAVLTreeUnion(GenAVLTree* dst, GenAVLTree* src, int threads) {
+  c_policy p(dst);
+  GenAVLEntry* dups;
+
+  p.set_root(genavl::detail::unite(p, dst->root, src->root, &dups,
+                                   genavl::detail::fork_depth(threads)));
+  c_policy(src).set_root(dups);
+}
+
+/*******************************************************
+ *
+ * Keep only the entries of dst with keys in src
+ *
+ *******************************************************/
+void GenAVLTreeIntersect(GenAVLTree* dst,
+                         GenAVLTree* src,
+                         GenAVLTree* removed,
+                         int threads) {
+  c_policy p(dst);
+  GenAVLEntry* rem;
+
+  p.set_root(genavl::detail::intersect(p, dst->root, src->root, &rem,
+                                       genavl::detail::fork_depth(threads)));
+  if (removed)
+    c_policy(removed).set_root(rem);
+}
+
+/*******************************************************
+ *
+ * Keep only the entries of dst with keys not in src
+ *
+ *******************************************************/
+void GenAVLTreeDifference(GenAVLTree* dst,
+                          GenAVLTree* src,
+                          GenAVLTree* removed,
+                          int threads) {
+  c_policy p(dst);
+  GenAVLEntry* rem;
+
+  p.set_root(genavl::detail::difference(p, dst->root, src->root, &rem,
+                                        genavl::detail::fork_depth(threads)));
+  if (removed)
+    c_policy(removed).set_root(rem);
+}
+
+/*******************************************************
+ *
+ * Run the lookups for the keys in groups, one level of
+ * every descent in the group at a time. The entries
+ * reached in one round are prefetched, then their data
+ * at the start of the next, before any are compared.
+ * The mode picks the result: 0 for an equal entry, 1 for
+ * the least greater or equal and -1 for the greatest
+ * less or equal.
+ *
+ *******************************************************/
+static void GenAVLTreeBatch(GenAVLTree* gatp,
+                            const void* const* keys,
+                            size_t n,
+                            GenAVLEntry** out,
+                            int mode) {
+  c_policy p(gatp);
+  c_policy::key_type key[GENAVL_BATCH_GROUP];
+  GenAVLEntry* gaep[GENAVL_BATCH_GROUP];
+  GenAVLEntry* best[GENAVL_BATCH_GROUP];
+  size_t base;
+  void* dp;
+  int live;
+  int dir;
+  int g;
+  int i;
+
+  for (base = 0; base < n; base += g) {
+    g = n - base < GENAVL_BATCH_GROUP ? (int)(n - base) : GENAVL_BATCH_GROUP;
+    for (i = 0; i < g; i++) {
+      key[i] = p.make_key(keys[base + i]);
+      gaep[i] = gatp->root;
+      best[i] = 0;
+    }
+
+    for (live = gaep[0] ? g : 0; live;) {
+      for (i = 0; i < g; i++) {
+        if (gaep[i]) {
+          dp = gaep[i]->data;
+          GENAVL_PREFETCH(dp);
+        }
+      }
+      for (i = 0; i < g; i++) {
+        if (!gaep[i])
+          continue;
+        if ((dir = p.compare(gaep[i], key[i])) == 0) {
+          best[i] = gaep[i];
+          gaep[i] = 0;
+        } else if (dir > 0) {
+          if (mode > 0)
+            best[i] = gaep[i];
+          gaep[i] = gaep[i]->left;
+        } else {
+          if (mode < 0)
+            best[i] = gaep[i];
+          gaep[i] = gaep[i]->right;
+        }
+        if (gaep[i])
+          GENAVL_PREFETCH(gaep[i]);
+        else
+          live--;
+      }
+    }
+
+    for (i = 0; i < g; i++)
+      out[base + i] = best[i];
+  }
+}
+
+/*******************************************************
+ *
+ * Look up each of the n keys as GenAVLTreeFind would
+ *
+ *******************************************************/
+void GenAVLTreeFindBatch(GenAVLTree* gatp,
+                         const void* const* keys,
+                         size_t n,
+                         GenAVLEntry** out) {
+  GenAVLTreeBatch(gatp, keys, n, out, 0);
+}
+
+/*******************************************************
+ *
+ * Look up each of the n keys as GenAVLTreeEqualNext
+ * would
+ *
+ *******************************************************/
+void GenAVLTreeEqualNextBatch(GenAVLTree* gatp,
+                              const void* const* keys,
+                              size_t n,
+                              GenAVLEntry** out) {
+  GenAVLTreeBatch(gatp, keys, n, out, 1);
+}
+
+/*******************************************************
+ *
+ * Look up each of the n keys as GenAVLTreeEqualPrev
+ * would
+ *
+ *******************************************************/
+void GenAVLTreeEqualPrevBatch(GenAVLTree* gatp,
+                              const void* const* keys,
+                              size_t n,
+                              GenAVLEntry** out) {
+  GenAVLTreeBatch(gatp, keys, n, out, -1);
+}
+
+/*******************************************************
+ *
+ * Start a finger at the root of the tree
+ *
+ *******************************************************/
+void GenAVLFingerInit(GenAVLFinger* gafp, GenAVLTree* gatp) {
+  gafp->gatp = gatp;
+  gafp->sp = 0;
+  if (gatp->root) {
+    gafp->stack[0].e = gatp->root;
+    gafp->stack[0].lo = 0;
+    gafp->stack[0].hi = 0;
+    gafp->sp = 1;
+  }
+}
+
+/*******************************************************
+ *
+ * Climb the path until the subtree on top holds the key
+ * strictly between its bounds, then descend from there
+ * as a lookup from the root would, pushing the entries
+ * passed. The bounds are the entries last turned right
+ * and left at above the subtree, so they seed the
+ * result. The root has no bounds and is never popped.
+ *
+ *******************************************************/
+static GenAVLEntry* GenAVLFingerSeek(GenAVLFinger* gafp,
+                                     const void* key,
+                                     int mode) {
+  c_policy p(gafp->gatp);
+  c_policy::key_type k = p.make_key(key);
+  GenAVLEntry* gaep;
+  GenAVLEntry* best;
+  GenAVLEntry* lo;
+  GenAVLEntry* hi;
+  int sp = gafp->sp;
+  int dir;
+
+  if (sp == 0)
+    return 0;
+  while (sp > 1 && ((gafp->stack[sp - 1].hi &&
+                     p.compare(gafp->stack[sp - 1].hi, k) <= 0) ||
+                    (gafp->stack[sp - 1].lo &&
+                     p.compare(gafp->stack[sp - 1].lo, k) >= 0)))
+    sp--;
+
+  gaep = gafp->stack[sp - 1].e;
+  lo = gafp->stack[sp - 1].lo;
+  hi = gafp->stack[sp - 1].hi;
+  best = mode > 0 ? hi : mode < 0 ? lo : 0;
+  for (;;) {
+    if ((dir = p.compare(gaep, k)) == 0) {
+      best = gaep;
+      break;
+    }
+    if (dir > 0) {
+      if (mode > 0)
+        best = gaep;
+      hi = gaep;
+      gaep = gaep->left;
+    } else {
+      if (mode < 0)
+        best = gaep;
+      lo = gaep;
+      gaep = gaep->right;
+    }
+    if (!gaep)
+      break;
+    gafp->stack[sp].e = gaep;
+    gafp->stack[sp].lo = lo;
+    gafp->stack[sp].hi = hi;
+    sp++;
+  }
+  gafp->sp = sp;
+  return best;
+}
+
+/*******************************************************
+ *
+ * Find the entry equal to the key, starting from where
+ * the last lookup of the finger ended
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLFingerFind(GenAVLFinger* gafp, const void* key) {
+  return GenAVLFingerSeek(gafp, key, 0);
+}
+
+/*******************************************************
+ *
+ * Find the least entry greater than or equal to the key,
+ * starting from where the last lookup ended
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLFingerEqualNext(GenAVLFinger* gafp, const void* key) {
+  return GenAVLFingerSeek(gafp, key, 1);
+}
+
+/*******************************************************
+ *
+ * Find the greatest entry less than or equal to the key,
+ * starting from where the last lookup ended
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLFingerEqualPrev(GenAVLFinger* gafp, const void* key) {
+  return GenAVLFingerSeek(gafp, key, -1);
+}
+
+/*******************************************************
+ *
+ * Run a finger over an array of keys in ascending order
+ *
+ *******************************************************/
+static void GenAVLTreeSorted(GenAVLTree* gatp,
+                             const void* const* keys,
+                             size_t n,
+                             GenAVLEntry** out,
+                             int mode) {
+  GenAVLFinger gaf;
+  size_t i;
+
+  GenAVLFingerInit(&gaf, gatp);
+  for (i = 0; i < n; i++)
+    out[i] = GenAVLFingerSeek(&gaf, keys[i], mode);
+}
+
+/*******************************************************
+ *
+ * Look up each of the n sorted keys as GenAVLTreeFind
+ * would
+ *
+ *******************************************************/
+void GenAVLTreeFindSorted(GenAVLTree* gatp,
+                          const void* const* keys,
+                          size_t n,
+                          GenAVLEntry** out) {
+  GenAVLTreeSorted(gatp, keys, n, out, 0);
+}
+
+/*******************************************************
+ *
+ * Look up each of the n sorted keys as
+ * GenAVLTreeEqualNext would
+ *
+ *******************************************************/
+void GenAVLTreeEqualNextSorted(GenAVLTree* gatp,
+                               const void* const* keys,
+                               size_t n,
+                               GenAVLEntry** out) {
+  GenAVLTreeSorted(gatp, keys, n, out, 1);
+}
+
+/*******************************************************
+ *
+ * Look up each of the n sorted keys as
+ * GenAVLTreeEqualPrev would
+ *
+ *******************************************************/
+void GenAVLTreeEqualPrevSorted(GenAVLTree* gatp,
+                               const void* const* keys,
+                               size_t n,
+                               GenAVLEntry** out) {
+  GenAVLTreeSorted(gatp, keys, n, out, -1);
+}
+
+/*******************************************************
+ *
+ * Find and return a pointer to the entry given by the
+ * key data. Return 0 if no such entry is in the tree.
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLTreeFind(GenAVLTree* gatp, const void* key) {
+  c_policy p(gatp);
+
+  return genavl::detail::find(p, p.make_key(key));
+}
+void* GenAVLTreeFindData(GenAVLTree* gatp, const void* key) {
+  GenAVLEntry* gaep;
 
   if ((gaep = GenAVLTreeFind(gatp, key)) == nullptr)
     return 0;
@@ -542,15 +1300,9 @@ void* GenAVLTreeFindData(GenAVLTree* gatp, const void* key) {
  *
  *******************************************************/
 GenAVLEntry* GenAVLTreeFirst(GenAVLTree* gatp) {
-  GenAVLEntry* gaep;
-  GenAVLEntry* first;
-
-  for (first = 0, gaep = gatp->root; gaep;) {
-    first = gaep;
-    gaep = gaep->left;
-  }
+  c_policy p(gatp);
 
-  return first;
+  return genavl::detail::first(p);
 }
 void* GenAVLTreeFirstData(GenAVLTree* gatp) {
   GenAVLEntry* gaep;
@@ -569,19 +1321,9 @@ void* GenAVLTreeFirstData(GenAVLTree* gatp) {
  *
  *******************************************************/
 GenAVLEntry* GenAVLTreeNext(GenAVLTree* gatp, const void* key) {
-  GenAVLEntry* gaep;
-  GenAVLEntry* next;
-
-  for (next = 0, gaep = gatp->root; gaep;) {
-    if (gatp->Compare(gaep, key) > 0) {
-      next = gaep;
-      gaep = gaep->left;
-    } else {
-      gaep = gaep->right;
-    }
-  }
+  c_policy p(gatp);
 
-  return next;
+  return genavl::detail::next(p, p.make_key(key));
 }
 void* GenAVLTreeNextData(GenAVLTree* gatp, const void* key) {
   GenAVLEntry* gaep;
@@ -601,23 +1343,9 @@ void* GenAVLTreeNextData(GenAVLTree* gatp, const void* key) {
  *
  *******************************************************/
 GenAVLEntry* GenAVLTreeEqualNext(GenAVLTree* gatp, const void* key) {
-  GenAVLEntry* gaep;
-  GenAVLEntry* next;
-  int dir;
-
-  for (next = 0, gaep = gatp->root; gaep;) {
-    if ((dir = gatp->Compare(gaep, key)) > 0) {
-      next = gaep;
-      gaep = gaep->left;
-    } else {
-      if (dir < 0)
-        gaep = gaep->right;
-      else
-        return gaep;
-    }
-  }
+  c_policy p(gatp);
 
-  return next;
+  return genavl::detail::equal_next(p, p.make_key(key));
 }
 void* GenAVLTreeEqualNextData(GenAVLTree* gatp, const void* key) {
   GenAVLEntry* gaep;
@@ -636,19 +1364,9 @@ void* GenAVLTreeEqualNextData(GenAVLTree* gatp, const void* key) {
  *
  *******************************************************/
 GenAVLEntry* GenAVLTreePrev(GenAVLTree* gatp, const void* key) {
-  GenAVLEntry* gaep;
-  GenAVLEntry* prev;
+  c_policy p(gatp);
 
-  for (prev = 0, gaep = gatp->root; gaep;) {
-    if (gatp->Compare(gaep, key) < 0) {
-      prev = gaep;
-      gaep = gaep->right;
-    } else {
-      gaep = gaep->left;
-    }
-  }
-
-  return prev;
+  return genavl::detail::prev(p, p.make_key(key));
 }
 void* GenAVLTreePrevData(GenAVLTree* gatp, const void* key) {
   GenAVLEntry* gaep;
@@ -668,23 +1386,9 @@ void* GenAVLTreePrevData(GenAVLTree* gatp, const void* key) {
  *
  *******************************************************/
 GenAVLEntry* GenAVLTreeEqualPrev(GenAVLTree* gatp, const void* key) {
-  GenAVLEntry* gaep;
-  GenAVLEntry* prev;
-  int dir;
+  c_policy p(gatp);
 
-  for (prev = 0, gaep = gatp->root; gaep;) {
-    if ((dir = gatp->Compare(gaep, key)) < 0) {
-      prev = gaep;
-      gaep = gaep->right;
-    } else {
-      if (dir > 0)
-        gaep = gaep->left;
-      else
-        return gaep;
-    }
-  }
-
-  return prev;
+  return genavl::detail::equal_prev(p, p.make_key(key));
 }
 void* GenAVLTreeEqualPrevData(GenAVLTree* gatp, const void* key) {
   GenAVLEntry* gaep;
@@ -699,7 +1403,10 @@ void* GenAVLTreeEqualPrevData(GenAVLTree* gatp, const void* key) {
  *
  * Add the given GenAVLEntry to the tree. If there
  * exists an entry with the same key already in the
- * tree, return 0. Otherwise return 1.
+ * tree, return 0, or -1 if the tree has an Augment
+ * and there was no memory for the path to apply it
+ * along, which needs USE_GENAVL_AUGMENT. Otherwise
+ * return 1.
  *
  * This function performs an AVL tree insertion without
  * balancing. Note that a tree which has been left
@@ -708,37 +1415,15 @@ void* GenAVLTreeEqualPrevData(GenAVLTree* gatp, const void* key) {
  * 
  * Using Unbalanced add has the advantage that the tree
  * will always be in a consistent state, even if the
- * process doing the Add is interrupted or killed.
+ * process doing the Add is interrupted or killed. For
+ * a tree in a mapped file, GenAVLMapTreeAdd gives the
+ * same guarantee with balancing.
  *
  *******************************************************/
 int GenAVLTreeAddUnbal(GenAVLTree* gatp, GenAVLEntry* gae) {
-  GenAVLEntry* gaep = 0;
-  GenAVLEntry* gaepnext;
-  int dir = 0;
-
-  /* Initialize the left and right ptrs   */
-  gae->left = 0;
-  gae->right = 0;
-  gae->balance = 0;
-
-  /* Find the insertion and balance point */
-  for (gaepnext = gatp->root; gaepnext;) {
-    gaep = gaepnext;
-    if ((dir = gatp->Compare(gae, gatp->Key(gaepnext))) < 0)
-      gaepnext = gaepnext->left;
-    else {
-      if (dir > 0)
-        gaepnext = gaepnext->right;
-      else
-        /* Entry already exists */
-        return 0;
-    }
-  }
-
-  /* Insert the new entry */
-  set(gatp, gaep, dir, gae);
+  c_policy p(gatp);
 
-  return 1;
+  return genavl::detail::add_unbal(p, gae);
 }
 
 /*******************************************************
@@ -752,64 +1437,31 @@ int GenAVLTreeAddUnbal(GenAVLTree* gatp, GenAVLEntry* gae) {
  *
  *******************************************************/
 int GenAVLTreeAdd(GenAVLTree* gatp, GenAVLEntry* gae) {
-  GenAVLEntry* gaep = 0;
-  GenAVLEntry* balgaep = 0;
-  GenAVLEntry* gaepnext;
-  int baldir = 0;
-  int dir = 0;
-
-  /* Initialize the left and right ptrs   */
-  gae->left = 0;
-  gae->right = 0;
-  gae->balance = 0;
-
-  /* Find the insertion and balance point */
-  for (gaepnext = gatp->root; gaepnext;) {
-    if (gaepnext->balance && gaep) {
-      balgaep = gaep;
-      baldir = dir;
-    }
+  c_policy p(gatp);
 
-    gaep = gaepnext;
-    if ((dir = gatp->Compare(gae, gatp->Key(gaepnext))) < 0)
-      gaepnext = gaepnext->left;
-    else {
-      if (dir > 0)
-        gaepnext = gaepnext->right;
-      else
-        /* Entry already exists */
-        return 0;
-    }
-  }
-
-  /* Insert the new entry */
-  set(gatp, gaep, dir, gae);
-
-  /* Balance starting at the balance point */
-  for (gaep = val(gatp, balgaep, baldir); gaep != gae;) {
-    if (gatp->Compare(gae, gatp->Key(gaep)) < 0) {
-      gaep->balance--;
-      gaep = gaep->left;
-    } else {
-      gaep->balance++;
-      gaep = gaep->right;
-    }
-  }
+  return genavl::detail::add(p, gae);
+}
 
-  /* Shift to restore proper balance if needed */
-  gaep = val(gatp, balgaep, baldir);
-  if (gaep->balance == 2) {
-    if (gaep->right->balance == 1)
-      shiftleft(gatp, balgaep, baldir);
-    else if (gaep->right->balance == -1)
-      shiftdblleft(gatp, balgaep, baldir);
-  } else if (gaep->balance == -2) {
-    if (gaep->left->balance == -1)
-      shiftright(gatp, balgaep, baldir);
-    else if (gaep->left->balance == 1)
-      shiftdblright(gatp, balgaep, baldir);
-  }
-  return 1;
+/*******************************************************
+ *
+ * Add the given GenAVLEntry to the tree, searching for
+ * its place from the hint entry or, if there is none,
+ * trying it as the last entry first
+ *
+ *******************************************************/
+int GenAVLTreeAddHint(GenAVLTree* gatp, GenAVLEntry* gae, GenAVLEntry* hint) {
+  c_policy p(gatp);
+  int added;
+
+#if defined(USE_GENAVL_PARENT)
+  if (hint)
+    return genavl::detail::add_near(p, gae, hint);
+#else
+  (void)hint;
+#endif
+  if ((added = genavl::detail::add_last(p, gae)) >= 0)
+    return added;
+  return genavl::detail::add(p, gae);
 }
 
 /***********************************************************
@@ -823,115 +1475,221 @@ int GenAVLTreeAdd(GenAVLTree* gatp, GenAVLEntry* gae) {
  *
  ***********************************************************/
 void* GenAVLTreeDelete(GenAVLTree* gatp, const void* key) {
-  GenAVLStackEntry stack[MAX_GENAVL_STACK];
-  GenAVLStackEntry* gasep;
-  GenAVLEntry* gaepnext;
-  void* data;
-  GenAVLEntry* gaep = 0;
-  int dir = 0;
-
-  for (gasep = stack, gaepnext = gatp->root;;) {
-    if (!gaepnext)
-      return 0;
-
-    /* Push the previous entry onto the stack */
-    gasep->e = gaep;
-    gasep->d = dir;
-    gasep++;
-
-    gaep = gaepnext;
-    if ((dir = gatp->Compare(gaepnext, key)) > 0)
-      gaepnext = gaepnext->left;
-    else {
-      if (dir < 0)
-        gaepnext = gaepnext->right;
-      else
-        break;
-    }
+  c_policy p(gatp);
+  GenAVLEntry* gaep;
+
+  if ((gaep = genavl::detail::erase(p, p.make_key(key))) == nullptr)
+    return 0;
+  else
+    return gaep->data;
+}
+
+#if defined(USE_GENAVL_PARENT)
+/*******************************************************
+ *
+ * Return the entry following the given one in key
+ * order or 0 if it is the last
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLEntryNext(GenAVLEntry* gaep) {
+  c_policy p(0);
+
+  return genavl::detail::entry_next(p, gaep);
+}
+
+/*******************************************************
+ *
+ * Return the entry preceding the given one in key
+ * order or 0 if it is the first
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLEntryPrev(GenAVLEntry* gaep) {
+  c_policy p(0);
+
+  return genavl::detail::entry_prev(p, gaep);
+}
+
+/*******************************************************
+ *
+ * Remove the given entry from the tree without
+ * searching for it
+ *
+ *******************************************************/
+void GenAVLTreeRemoveEntry(GenAVLTree* gatp, GenAVLEntry* gaep) {
+  c_policy p(gatp);
+
+  genavl::detail::erase_entry(p, gaep);
+}
+
+/*******************************************************
+ *
+ * Find and return a pointer to the entry given by the
+ * key, searching from the hint entry. Return 0 if no
+ * such entry is in the tree.
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLTreeFindNear(GenAVLTree* gatp,
+                                const void* key,
+                                GenAVLEntry* hint) {
+  c_policy p(gatp);
+
+  return genavl::detail::find_near(p, p.make_key(key), hint);
+}
+
+/*******************************************************
+ *
+ * Return the entry with the least key greater than or
+ * equal to the given key, searching from the hint
+ * entry, or 0 if there is none
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLTreeEqualNextNear(GenAVLTree* gatp,
+                                     const void* key,
+                                     GenAVLEntry* hint) {
+  c_policy p(gatp);
+
+  return genavl::detail::equal_next_near(p, p.make_key(key), hint);
+}
+#endif
+
+/*******************************************************
+ *
+ * Lay the entries of the tree out in the slots in
+ * Eytzinger order: slot k - 1 holds node k of a
+ * complete binary tree whose node k has children 2k
+ * and 2k + 1. The in-order walk of the tree is matched
+ * by an in-order walk of the node numbers.
+ *
+ *******************************************************/
+size_t GenAVLTreeFreeze(GenAVLTree* gatp,
+                        GenAVLFrozen* gafp,
+                        GenAVLFrozenSlot* slots,
+                        size_t n) {
+  GenAVLEntry* stack[MAX_GENAVL_STACK];
+  GenAVLEntry* gaep;
+  size_t count = 0;
+  size_t k;
+  int sp = 0;
 
-    /* Change direction since the key is compared  */
-    /* against some entry - the compare polarity   */
-    /* is opposite the normal direction            */
-    dir = 0 - dir;
+  for (gaep = gatp->root; gaep || sp;) {
+    for (; gaep; gaep = gaep->left)
+      stack[sp++] = gaep;
+    gaep = stack[--sp];
+    count++;
+    gaep = gaep->right;
   }
-  data = gaep->data;
-
-  /* Swap with previous element */
-  if (gaep->right && gaep->left) {
-    GenAVLStackEntry* savegasep;
-    GenAVLEntry* saveleft;
-    GenAVLStackEntry* tempgasep;
-
-    savegasep = gasep;
-    gasep->e = gaep;
-    gasep->d = -1;
-    gasep++;
-    gaepnext = gaep->left;
-    while (gaepnext->right) {
-      gasep->e = gaepnext;
-      gasep->d = 1;
-      gasep++;
-      gaepnext = gaepnext->right;
+  if (count > n)
+    return count;
+
+  gafp->slots = slots;
+  gafp->n = count;
+  gafp->Compare = gatp->Compare;
+#if defined(USE_GENAVL_PREFIX)
+  gafp->Prefix = gatp->Prefix;
+#endif
+
+  /* Start from the left-most node number             */
+  for (k = 1; 2 * k <= count; k *= 2)
+    ;
+  for (gaep = gatp->root; gaep || sp;) {
+    for (; gaep; gaep = gaep->left)
+      stack[sp++] = gaep;
+    gaep = stack[--sp];
+
+    slots[k - 1].entry = gaep;
+#if defined(USE_GENAVL_PREFIX)
+    slots[k - 1].prefix = gaep->prefix;
+#endif
+
+    /* Step to the in-order successor of node k      */
+    if (2 * k + 1 <= count) {
+      for (k = 2 * k + 1; 2 * k <= count; k *= 2)
+        ;
+    } else {
+      while (k & 1)
+        k >>= 1;
+      k >>= 1;
     }
-    saveleft = gaepnext->left;
-    /* Swap gaep and savegaep */
-    savegasep->e = gaepnext;
-    savegasep->d = -1;
-    tempgasep = savegasep - 1;
-    set(gatp, tempgasep->e, tempgasep->d, gaepnext);
-    gaepnext->right = gaep->right;
-    gaepnext->left = gaep->left;
-    gaepnext->balance = gaep->balance;
-    gaep->right = 0;
-    gaep->left = saveleft;
+    gaep = gaep->right;
   }
+  return count;
+}
 
-  /* Delete entry from tree */
-  gasep = gasep - 1;
-  set(gatp, gasep->e, gasep->d, gaep->right ? gaep->right : gaep->left);
-
-  /* Go back up tree, rebalancing when necessary */
-  while (gasep > stack) {
-    gaepnext = gasep->e;
-    if (gasep->d > 0)
-      gaepnext->balance--;
+/*******************************************************
+ *
+ * Descend the frozen snapshot, going right past the
+ * slots less than the key (or, if equal is set, less
+ * than or equal to it). Returns the final node number,
+ * whose bits record the path taken.
+ *
+ *******************************************************/
+static size_t GenAVLFrozenDescend(GenAVLFrozen* gafp,
+                                  const void* key,
+                                  int equal) {
+  GenAVLFrozenSlot* slots = gafp->slots;
+  size_t n = gafp->n;
+  size_t k = 1;
+  int dir;
+#if defined(USE_GENAVL_PREFIX)
+  uint64_t prefix = gafp->Prefix ? gafp->Prefix(key) : 0;
+#endif
+
+  while (k <= n) {
+    /* Node 16k is four levels below                  */
+    GENAVL_PREFETCH(&slots[(16 * k <= n ? 16 * k : k) - 1]);
+#if defined(USE_GENAVL_PREFIX)
+    if (slots[k - 1].prefix != prefix)
+      dir = slots[k - 1].prefix < prefix ? -1 : 1;
     else
-      gaepnext->balance++;
-
-    gasep = gasep - 1;
-    gaep = gasep->e;
-    dir = gasep->d;
-    if (gaepnext->balance == 2) {
-      if (gaepnext->right->balance == 1)
-        shiftleft(gatp, gaep, dir);
-      else {
-        if (gaepnext->right->balance == -1)
-          shiftdblleft(gatp, gaep, dir);
-        else {
-          shiftleft(gatp, gaep, dir);
-          break;
-        }
-      }
-      continue;
-    } else if (gaepnext->balance == -2) {
-      if (gaepnext->left->balance == -1)
-        shiftright(gatp, gaep, dir);
-      else {
-        if (gaepnext->left->balance == 1)
-          shiftdblright(gatp, gaep, dir);
-        else {
-          shiftright(gatp, gaep, dir);
-          break;
-        }
-      }
-      continue;
-    } else {
-      if (gaepnext->balance == 0)
-        continue;
-      else
-        break;
-    }
+#endif
+      dir = gafp->Compare(slots[k - 1].entry, key);
+    k = 2 * k + (dir < 0 || (dir == 0 && equal));
   }
+  return k;
+}
+
+/*******************************************************
+ *
+ * Return the least entry greater than or equal to the
+ * key in the snapshot, or 0 if there is none. It is
+ * the last node the descent went left from.
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLFrozenEqualNext(GenAVLFrozen* gafp, const void* key) {
+  size_t k = GenAVLFrozenDescend(gafp, key, 0);
+
+  while (k & 1)
+    k >>= 1;
+  k >>= 1;
+  return k ? gafp->slots[k - 1].entry : 0;
+}
+
+/*******************************************************
+ *
+ * Return the greatest entry less than or equal to the
+ * key in the snapshot, or 0 if there is none. It is
+ * the last node the descent went right from.
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLFrozenEqualPrev(GenAVLFrozen* gafp, const void* key) {
+  size_t k = GenAVLFrozenDescend(gafp, key, 1);
 
-  return data;
+  while (k && !(k & 1))
+    k >>= 1;
+  k >>= 1;
+  return k ? gafp->slots[k - 1].entry : 0;
+}
+
+/*******************************************************
+ *
+ * Return the entry equal to the key in the snapshot,
+ * or 0 if there is none
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLFrozenFind(GenAVLFrozen* gafp, const void* key) {
+  GenAVLEntry* gaep = GenAVLFrozenEqualPrev(gafp, key);
+
+  if (gaep && gafp->Compare(gaep, key) == 0)
+    return gaep;
+  return 0;
 }
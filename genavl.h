@@ -21,11 +21,39 @@
 #ifndef GENAVL_H
 #define GENAVL_H
 
+#include <stddef.h>
+
 #define USE_OFFSET_PTR
 #if defined(USE_OFFSET_PTR)
 #include "offset_ptr.h"
 #endif
 
+/* Define USE_GENAVL_COUNT to keep the number of entries of each
+ * subtree in its GenAVLEntry. This enables GenAVLTreeCount,
+ * GenAVLTreeRank, GenAVLTreeSelect and GenAVLTreeCountRange. */
+/* #define USE_GENAVL_COUNT */
+
+/* Define USE_GENAVL_PARENT to keep a link to the parent in each
+ * GenAVLEntry. This enables GenAVLEntryNext, GenAVLEntryPrev and
+ * GenAVLTreeRemoveEntry, which work from an entry instead of
+ * searching for its key. */
+/* #define USE_GENAVL_PARENT */
+
+/* Define USE_GENAVL_PREFIX to keep an 8-byte prefix of each entry's
+ * key in its GenAVLEntry. Trees with a Prefix method then compare
+ * prefixes on the way down and call Compare only when they are
+ * equal, which saves following data to the key at most levels. */
+/* #define USE_GENAVL_PREFIX */
+#if defined(USE_GENAVL_PREFIX)
+#include <stdint.h>
+#endif
+
+/* Define USE_GENAVL_AUGMENT to give GenAVLTree an Augment method
+ * which keeps a value over each subtree in the entry's data. This
+ * enables GenAVLTreeAggregateRange, GenAVLTreeReaugment and the
+ * GenAVLIntervalTree. */
+/* #define USE_GENAVL_AUGMENT */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -46,20 +74,48 @@ extern "C" {
  * all GenAVLEntry objects.
  *
  * Note that the given implementation does not track the number
- * of entries or any other statistics. This is left to derived
- * classes.
+ * of entries or any other statistics unless USE_GENAVL_COUNT
+ * is defined, in which case count holds the number of entries
+ * in the subtree rooted at the entry. It sits in what is
+ * otherwise padding after balance.
+ *
+ * When USE_GENAVL_PREFIX is defined, prefix holds the Prefix of
+ * the entry's key, set when the entry is added to a tree.
+ *
+ * When USE_GENAVL_PARENT is defined, parent links each entry to
+ * the entry above it, or is 0 for the root. Like the other links
+ * it is an offset_ptr when USE_OFFSET_PTR is defined, so the tree
+ * can still live in shared memory.
  *
  ***************************************************************/
 typedef struct GENAVLENTRY {
 #if defined(USE_OFFSET_PTR)
   offset_ptr<void> data;
   int balance;
+#if defined(USE_GENAVL_COUNT)
+  unsigned int count;
+#endif
+#if defined(USE_GENAVL_PREFIX)
+  uint64_t prefix;
+#endif
   offset_ptr<struct GENAVLENTRY> right;
   offset_ptr<struct GENAVLENTRY> left;
+#if defined(USE_GENAVL_PARENT)
+  offset_ptr<struct GENAVLENTRY> parent;
+#endif
 #else
   void* data;
+#if defined(USE_GENAVL_COUNT)
+  unsigned int count;
+#endif
+#if defined(USE_GENAVL_PREFIX)
+  uint64_t prefix;
+#endif
   struct GENAVLENTRY* right;
   struct GENAVLENTRY* left;
+#if defined(USE_GENAVL_PARENT)
+  struct GENAVLENTRY* parent;
+#endif
 #endif
 } GenAVLEntry;
 
@@ -93,9 +149,32 @@ typedef struct GENAVLENTRY {
  *   method is used by the NextFreeKey and does not otherwise
  *   need to be implemented
  *
+ *   void Augment(GenAVLEntry*) - with USE_GENAVL_AUGMENT,
+ *   recomputes a value kept in the entry's data over its
+ *   whole subtree (a sum, a maximum and so on) from the
+ *   entry's own value and the values kept by its left and
+ *   right children, either of which may be 0. It is called
+ *   bottom-up for every entry whose subtree changes, including
+ *   those moved by rotations. This method is optional and must
+ *   be 0 if it is not implemented. It is used by
+ *   GenAVLTreeAggregateRange and GenAVLIntervalTree.
+ *
+ *   uint64_t Prefix(const void*) - with USE_GENAVL_PREFIX,
+ *   returns a number which orders keys the same way as
+ *   Compare, at least in part: a key whose prefix is less than
+ *   another's must itself be less. Keys with equal prefixes
+ *   are left to Compare. For keys ordered as by memcmp,
+ *   GenAVLPrefixBytes gives a suitable prefix. This method is
+ *   optional and must be 0 if it is not implemented.
+ *
+ * GenAVLTreeInit sets up an empty tree with the given Compare
+ * and Key and every optional method 0; set any of those wanted
+ * after it. A tree filled in field by field must set every
+ * optional method enabled by the USE_GENAVL_ macros as well.
+ *
  * Note that the given implementation does not track the number
  * of entries or any other statistics. This is left to derived
- * classes.
+ * classes, or to Augment.
  *
  ***************************************************************/
 typedef struct GENAVLTREE {
@@ -104,9 +183,18 @@ typedef struct GENAVLTREE {
   void* (*Key)(GenAVLEntry*);
   int (*KeyIncrement)(void*);
   int (*KeyCompare)(const void*, const void*);
+#if defined(USE_GENAVL_AUGMENT)
+  void (*Augment)(GenAVLEntry*);
+#endif
+#if defined(USE_GENAVL_PREFIX)
+  uint64_t (*Prefix)(const void*);
+#endif
 } GenAVLTree;
 
 void GenAVLInit(GenAVLEntry*, void*);
+void GenAVLTreeInit(GenAVLTree*,
+                    int (*)(GenAVLEntry*, const void*),
+                    void* (*)(GenAVLEntry*));
 int GenAVLTreeAdd(GenAVLTree*, GenAVLEntry*);
 int GenAVLTreeAddUnbal(GenAVLTree* gatp, GenAVLEntry* gae);
 void* GenAVLTreeDelete(GenAVLTree*, const void*);
@@ -124,6 +212,298 @@ void* GenAVLTreeEqualPrevData(GenAVLTree*, const void*);
 void* GenAVLTreeFindData(GenAVLTree*, const void*);
 int GenAVLTreeNextFreeKey(GenAVLTree*, const void*, void*);
 
+/***************************************************************
+ *
+ * Batched lookups
+ *
+ * GenAVLTreeFindBatch sets out[i] to GenAVLTreeFind(t, keys[i])
+ * for each of the n keys, and GenAVLTreeEqualNextBatch and
+ * GenAVLTreeEqualPrevBatch do the same for GenAVLTreeEqualNext
+ * and GenAVLTreeEqualPrev. The descents are run in groups of
+ * GENAVL_BATCH_GROUP, a level at a time, prefetching the next
+ * entry and key of each, so the cache misses of a group
+ * overlap instead of being taken one after another. This pays
+ * off on trees too large for the cache; the keys need not be
+ * sorted.
+ *
+ ***************************************************************/
+#define GENAVL_BATCH_GROUP 16
+
+void GenAVLTreeFindBatch(GenAVLTree*,
+                         const void* const*,
+                         size_t,
+                         GenAVLEntry**);
+void GenAVLTreeEqualNextBatch(GenAVLTree*,
+                              const void* const*,
+                              size_t,
+                              GenAVLEntry**);
+void GenAVLTreeEqualPrevBatch(GenAVLTree*,
+                              const void* const*,
+                              size_t,
+                              GenAVLEntry**);
+#if defined(USE_GENAVL_PREFIX)
+uint64_t GenAVLPrefixBytes(const void*, size_t);
+#endif
+
+/***************************************************************
+ *
+ * GenAVLTreeBuildSorted replaces the contents of the tree with
+ * the n given entries, which must already be in strictly
+ * ascending key order. The entries are linked into a perfectly
+ * balanced tree in linear time without calling Compare. Any
+ * entries previously in the tree are dropped without being
+ * unlinked.
+ *
+ * GenAVLTreeBuildStream does the same but pulls the n entries,
+ * in ascending order, one at a time from the next callback, so
+ * the caller does not need to hold them all in an array. For
+ * example, to load a tree from a sorted list:
+ *
+ * GenAVLEntry *next_from_list(void *ctx) {
+ *   MyData **cursor = (MyData **)ctx;
+ *   MyData *d = *cursor;
+ *
+ *   *cursor = d->next;
+ *   GenAVLInit(&d->avl, d);
+ *   return &d->avl;
+ * }
+ *
+ * GenAVLTreeBuildStream(t, count, next_from_list, &head);
+ *
+ ***************************************************************/
+void GenAVLTreeBuildSorted(GenAVLTree*, GenAVLEntry**, size_t);
+void GenAVLTreeBuildStream(GenAVLTree*,
+                           size_t,
+                           GenAVLEntry* (*)(void*),
+                           void*);
+
+/***************************************************************
+ *
+ * GenAVLTreeAddBatch adds n entries to the tree in one call.
+ * The entries array is sorted in place by key unless the
+ * sorted argument is non-zero, in which case it must already
+ * be in ascending order. On return added[i] is 1 if entries[i]
+ * was added and 0 if an entry with the same key was already in
+ * the tree or appeared earlier in the batch, just as
+ * GenAVLTreeAdd would have returned. The number of entries
+ * added is returned.
+ *
+ * Batches that are large compared to the tree are merged with
+ * it and relinked in a single pass, with no rotations. Small
+ * batches are built into a tree of their own and united with
+ * it (see GenAVLTreeUnion).
+ *
+ ***************************************************************/
+size_t GenAVLTreeAddBatch(GenAVLTree*, GenAVLEntry**, size_t, int, int*);
+
+/***************************************************************
+ *
+ * Join, split and set operations
+ *
+ * GenAVLTreeJoin appends the middle entry (which may be 0) and
+ * then all of the entries of the right tree to the left tree.
+ * Every key in the left tree must be less than the middle key
+ * and every key in the right tree greater. The right tree is
+ * left empty. This costs O(log n).
+ *
+ * GenAVLTreeSplit moves the entries of the tree with keys
+ * greater than the given key into the right tree, whose
+ * previous contents are dropped, and keeps those with lesser
+ * keys. The entry equal to the key is unlinked and returned,
+ * or 0 if there is none. This costs O(log n).
+ *
+ * The set operations below cost O(m log(n/m + 1)) comparisons
+ * for trees of m <= n entries. All entries stay in one of the
+ * trees passed in, so none are lost:
+ *
+ *   GenAVLTreeUnion - moves the entries of src whose keys are
+ *   not in dst into dst. src is left holding the entries whose
+ *   keys were already in dst.
+ *
+ *   GenAVLTreeIntersect - keeps in dst only the entries whose
+ *   keys are also in src, moving the others to removed.
+ *
+ *   GenAVLTreeDifference - keeps in dst only the entries whose
+ *   keys are not in src, moving the others to removed.
+ *
+ * For the last two, src is not changed and removed may be 0 if
+ * the removed entries are not wanted; its previous contents are
+ * dropped. When threads is greater than one, large problems are
+ * split across up to that many threads, so Compare and Key must
+ * then be safe to call concurrently.
+ *
+ ***************************************************************/
+void GenAVLTreeJoin(GenAVLTree*, GenAVLEntry*, GenAVLTree*);
+GenAVLEntry* GenAVLTreeSplit(GenAVLTree*, const void*, GenAVLTree*);
+void GenAVLTreeUnion(GenAVLTree* dst, GenAVLTree* src, int threads);
+void GenAVLTreeIntersect(GenAVLTree* dst,
+                         GenAVLTree* src,
+                         GenAVLTree* removed,
+                         int threads);
+void GenAVLTreeDifference(GenAVLTree* dst,
+                          GenAVLTree* src,
+                          GenAVLTree* removed,
+                          int threads);
+
+#if defined(USE_GENAVL_COUNT)
+/***************************************************************
+ *
+ * Order statistics, available with USE_GENAVL_COUNT. Each
+ * takes O(log n):
+ *
+ *   GenAVLTreeCount - the number of entries in the tree.
+ *
+ *   GenAVLTreeRank - the number of entries with keys less than
+ *   the given key, which is the zero-based position of the key
+ *   if it is in the tree.
+ *
+ *   GenAVLTreeSelect - the entry at the given zero-based
+ *   position in key order, or 0 if there are not that many.
+ *
+ *   GenAVLTreeCountRange - the number of entries with keys
+ *   from lo to hi, inclusive.
+ *
+ * For instance, the 99th percentile entry is
+ *
+ *   GenAVLTreeSelect(t, GenAVLTreeCount(t) * 99 / 100);
+ *
+ ***************************************************************/
+size_t GenAVLTreeCount(GenAVLTree*);
+size_t GenAVLTreeRank(GenAVLTree*, const void*);
+GenAVLEntry* GenAVLTreeSelect(GenAVLTree*, size_t);
+size_t GenAVLTreeCountRange(GenAVLTree*, const void*, const void*);
+#endif
+
+/***************************************************************
+ *
+ * GenAVLTreeAddHint adds the entry like GenAVLTreeAdd, but
+ * first tries to place it near the hint entry, which must be in
+ * the tree. With a hint of 0, the entry is first tried as the
+ * new last entry, so adding keys in increasing order costs one
+ * comparison each. With USE_GENAVL_PARENT, a hint such as the
+ * previously added entry costs O(log d) comparisons, where d is
+ * the number of entries between it and the new one. Without
+ * USE_GENAVL_PARENT a non-zero hint cannot be climbed from and
+ * is ignored, and the last entry is tried as for a hint of 0.
+ *
+ ***************************************************************/
+int GenAVLTreeAddHint(GenAVLTree*, GenAVLEntry*, GenAVLEntry*);
+
+#if defined(USE_GENAVL_PARENT)
+/***************************************************************
+ *
+ * Entry-based navigation, available with USE_GENAVL_PARENT:
+ *
+ *   GenAVLEntryNext - the entry following the given one in key
+ *   order, or 0 if it is the last. Walking a whole tree this way
+ *   costs O(1) per step, amortized.
+ *
+ *   GenAVLEntryPrev - the entry preceding the given one in key
+ *   order, or 0 if it is the first.
+ *
+ *   GenAVLTreeRemoveEntry - removes the given entry, which must
+ *   be in the tree, without searching for its key. Compare is
+ *   not called.
+ *
+ *   GenAVLTreeFindNear and GenAVLTreeEqualNextNear - as
+ *   GenAVLTreeFind and GenAVLTreeEqualNext, but searching from
+ *   the hint entry, which must be in the tree, rather than from
+ *   the root. A key d entries away from the hint costs O(log d)
+ *   comparisons.
+ *
+ ***************************************************************/
+GenAVLEntry* GenAVLEntryNext(GenAVLEntry*);
+GenAVLEntry* GenAVLEntryPrev(GenAVLEntry*);
+void GenAVLTreeRemoveEntry(GenAVLTree*, GenAVLEntry*);
+GenAVLEntry* GenAVLTreeFindNear(GenAVLTree*, const void*, GenAVLEntry*);
+GenAVLEntry* GenAVLTreeEqualNextNear(GenAVLTree*, const void*, GenAVLEntry*);
+#endif
+
+#if defined(USE_GENAVL_AUGMENT)
+/***************************************************************
+ *
+ * Range aggregates, for trees with an Augment method
+ *
+ * GenAVLTreeAggregateRange folds the entries with keys from lo
+ * to hi, inclusive, into acc in key order, touching O(log n)
+ * entries. Either bound may be 0 to leave that end open. The
+ * fold callback is called with subtree set to 1 to fold in the
+ * value Augment keeps for the whole subtree of the entry, and
+ * with subtree set to 0 to fold in the entry's own value. For
+ * example, with a sum kept by Augment:
+ *
+ * void add_up(void *acc, GenAVLEntry *e, int subtree) {
+ *   MyData *d = (MyData *)e->data;
+ *
+ *   *(long *)acc += subtree ? d->subtree_sum : d->value;
+ * }
+ *
+ * long total = 0;
+ * GenAVLTreeAggregateRange(t, &lo, &hi, add_up, &total);
+ *
+ * GenAVLTreeReaugment calls Augment again along the path to
+ * the entry with the given key. Use it after changing the
+ * value, but not the key, of an entry already in the tree.
+ *
+ ***************************************************************/
+void GenAVLTreeAggregateRange(GenAVLTree*,
+                              const void* lo,
+                              const void* hi,
+                              void (*fold)(void*, GenAVLEntry*, int),
+                              void* acc);
+int GenAVLTreeReaugment(GenAVLTree*, const void*);
+#endif
+
+/***************************************************************
+ *
+ * Frozen snapshots
+ *
+ * GenAVLTreeFreeze lays the entries of a tree out in a single
+ * array in Eytzinger (breadth-first) order, for trees which are
+ * read far more often than they change. The caller supplies the
+ * n slots of the array. If the tree has more entries than that,
+ * nothing is written; either way the number of entries is
+ * returned, so a call with n of 0 sizes the array:
+ *
+ * size_t n = GenAVLTreeFreeze(t, &f, 0, 0);
+ * GenAVLFrozenSlot *slots = malloc(n * sizeof *slots);
+ * GenAVLTreeFreeze(t, &f, slots, n);
+ *
+ * GenAVLFrozenFind, GenAVLFrozenEqualNext and
+ * GenAVLFrozenEqualPrev then answer as GenAVLTreeFind,
+ * GenAVLTreeEqualNext and GenAVLTreeEqualPrev would have when
+ * the snapshot was taken. Each step down is an index
+ * computation with no branch on the comparison, and the slots
+ * four levels further down are prefetched on the way. With
+ * USE_GENAVL_PREFIX the key prefixes are copied into the slots,
+ * so the entries are only visited on a tie.
+ *
+ * The snapshot refers to the entries but not to the tree. It
+ * remains valid while the entries and their keys do, whatever
+ * happens to the tree afterwards.
+ *
+ ***************************************************************/
+typedef struct {
+#if defined(USE_GENAVL_PREFIX)
+  uint64_t prefix;
+#endif
+  GenAVLEntry* entry;
+} GenAVLFrozenSlot;
+
+typedef struct GENAVLFROZEN {
+  GenAVLFrozenSlot* slots;
+  size_t n;
+  int (*Compare)(GenAVLEntry*, const void*);
+#if defined(USE_GENAVL_PREFIX)
+  uint64_t (*Prefix)(const void*);
+#endif
+} GenAVLFrozen;
+
+size_t GenAVLTreeFreeze(GenAVLTree*, GenAVLFrozen*, GenAVLFrozenSlot*, size_t);
+GenAVLEntry* GenAVLFrozenFind(GenAVLFrozen*, const void*);
+GenAVLEntry* GenAVLFrozenEqualNext(GenAVLFrozen*, const void*);
+GenAVLEntry* GenAVLFrozenEqualPrev(GenAVLFrozen*, const void*);
+
 /***************************************************************
  *
  * This structure can be used by iterators to contain iterator
@@ -204,6 +584,12 @@ void GenAVLLLFIterReplace(GenAVLTree*, GenAVLEntry*);
  * Similarly, "greater-than-or-equal" can be done by using
  * the GenAVLDFIterInitNextEqualData initializer.
  *
+ * The tree can be walked backwards in the same way, starting
+ * with GenAVLDFIterInitLastData, GenAVLDFIterInitPrevData
+ * ("less-than" the key) or GenAVLDFIterInitPrevEqualData
+ * ("less-than-or-equal") and continuing with
+ * GenAVLDFIterPrevData.
+ *
  * Note that there is no protection against additions and
  * deletions to the tree while an iterator is operating on it
  *
@@ -213,6 +599,193 @@ void* GenAVLDFIterInitData(GenAVLDFIter*, GenAVLTree*);
 void* GenAVLDFIterInitNextEqualData(GenAVLDFIter*, GenAVLTree*, const void*);
 void* GenAVLDFIterInitNextData(GenAVLDFIter*, GenAVLTree*, const void*);
 void* GenAVLDFIterNextData(GenAVLDFIter*);
+void* GenAVLDFIterInitLastData(GenAVLDFIter*, GenAVLTree*);
+void* GenAVLDFIterInitPrevEqualData(GenAVLDFIter*, GenAVLTree*, const void*);
+void* GenAVLDFIterInitPrevData(GenAVLDFIter*, GenAVLTree*, const void*);
+void* GenAVLDFIterPrevData(GenAVLDFIter*);
+
+/***************************************************************
+ *
+ * GenAVLRangeIter walks the elements with keys between lo and
+ * hi, stopping by itself at the far bound, so the caller does
+ * not have to test each element. Either bound may be 0 to leave
+ * that end open. The flags are an or of
+ *
+ *   GENAVL_RANGE_LO_INCL - include an element equal to lo
+ *   GENAVL_RANGE_HI_INCL - include an element equal to hi
+ *   GENAVL_RANGE_REVERSE - walk from hi down to lo
+ *
+ * For example, the latest 10 entries before time t are
+ *
+ * void latest(GenAVLTree *tree, long t) {
+ *   GenAVLRangeIter gari;
+ *   MyData *data;
+ *   int n = 0;
+ *
+ *   for (data = GenAVLRangeIterInitData(&gari, tree, 0, &t,
+ *                                       GENAVL_RANGE_REVERSE);
+ *        data != 0 && n < 10;
+ *        data = GenAVLRangeIterNextData(&gari), n++) {
+ *     DoSomething(data);
+ *   }
+ *
+ * Note that there is no protection against additions and
+ * deletions to the tree while an iterator is operating on it
+ *
+ ***************************************************************/
+#define GENAVL_RANGE_LO_INCL 1
+#define GENAVL_RANGE_HI_INCL 2
+#define GENAVL_RANGE_REVERSE 4
+
+typedef struct {
+  GenAVLDFIter df;
+  GenAVLTree* gatp;
+  const void* end;
+  int flags;
+} GenAVLRangeIter;
+void* GenAVLRangeIterInitData(GenAVLRangeIter*,
+                              GenAVLTree*,
+                              const void*,
+                              const void*,
+                              int);
+void* GenAVLRangeIterNextData(GenAVLRangeIter*);
+
+/***************************************************************
+ *
+ * Sorted lookups
+ *
+ * A GenAVLFinger answers a stream of lookups whose keys come in
+ * ascending order. It keeps the path to the last entry it
+ * reached, together with the entries bounding each subtree on
+ * the path, and starts each lookup from the lowest subtree that
+ * can hold the key instead of from the root. A key d entries
+ * after the last costs O(log d), so m sorted keys are matched
+ * against a tree of n entries in O(m log(n/m + 1)). Keys out of
+ * order are still answered correctly, only more slowly.
+ *
+ * GenAVLFingerFind, GenAVLFingerEqualNext and
+ * GenAVLFingerEqualPrev return what GenAVLTreeFind,
+ * GenAVLTreeEqualNext and GenAVLTreeEqualPrev would.
+ * GenAVLTreeFindSorted and its two companions do the same for
+ * an array of n keys, setting out[i] for keys[i].
+ *
+ * long matched(GenAVLTree *tree, long *t, size_t n) {
+ *   GenAVLFinger gaf;
+ *   long m = 0;
+ *   size_t i;
+ *
+ *   GenAVLFingerInit(&gaf, tree);
+ *   for (i = 0; i < n; i++)
+ *     m += GenAVLFingerEqualPrev(&gaf, &t[i]) != 0;
+ *   return m;
+ * }
+ *
+ * As with the iterators, the tree must not be changed while a
+ * finger is in use.
+ *
+ ***************************************************************/
+typedef struct {
+  struct {
+    GenAVLEntry* e;
+    GenAVLEntry* lo;
+    GenAVLEntry* hi;
+  } stack[MAX_GENAVL_STACK];
+  int sp;
+  GenAVLTree* gatp;
+} GenAVLFinger;
+void GenAVLFingerInit(GenAVLFinger*, GenAVLTree*);
+GenAVLEntry* GenAVLFingerFind(GenAVLFinger*, const void*);
+GenAVLEntry* GenAVLFingerEqualNext(GenAVLFinger*, const void*);
+GenAVLEntry* GenAVLFingerEqualPrev(GenAVLFinger*, const void*);
+void GenAVLTreeFindSorted(GenAVLTree*,
+                          const void* const*,
+                          size_t,
+                          GenAVLEntry**);
+void GenAVLTreeEqualNextSorted(GenAVLTree*,
+                               const void* const*,
+                               size_t,
+                               GenAVLEntry**);
+void GenAVLTreeEqualPrevSorted(GenAVLTree*,
+                               const void* const*,
+                               size_t,
+                               GenAVLEntry**);
+
+#if defined(USE_GENAVL_AUGMENT)
+/***************************************************************
+ *
+ * GenAVLIntervalTree holds half-open intervals [start, end) in
+ * a GenAVLTree keyed by start. Besides the usual Compare, which
+ * compares an entry's start against a key, two more functions
+ * must be defined:
+ *
+ *   int EndCompare(GenAVLEntry*, const void *key) - compares
+ *   the entry's end against the key, as Compare does.
+ *
+ *   int MaxEndCompare(GenAVLEntry*, const void *key) - compares
+ *   the largest end in the entry's subtree against the key.
+ *
+ * The largest end of each subtree is kept in the entry's data
+ * by the tree's Augment method, so it stays correct across the
+ * rotations. For example:
+ *
+ * #define RES(e) ((Reservation *)(e)->data)
+ *
+ * void max_end(GenAVLEntry *e) {
+ *   RES(e)->max_end = RES(e)->end;
+ *   if (e->left && RES(e->left)->max_end > RES(e)->max_end)
+ *     RES(e)->max_end = RES(e->left)->max_end;
+ *   if (e->right && RES(e->right)->max_end > RES(e)->max_end)
+ *     RES(e)->max_end = RES(e->right)->max_end;
+ * }
+ *
+ * Entries are added and removed with the usual calls on the
+ * embedded tree. Keys must be unique, so intervals sharing a
+ * start need a tie-break in Compare.
+ *
+ * GenAVLIVIter iterates, in start order, over the intervals
+ * that contain a point (GenAVLIVIterInitStabData) or that
+ * overlap the range [lo, hi) (GenAVLIVIterInitOverlapData).
+ * The point, lo and hi are handed to the compare functions as
+ * keys. Subtrees whose largest end cannot reach the query are
+ * skipped, as is everything past its upper bound, so only paths
+ * leading to matches are walked. For example:
+ *
+ * void who_holds(GenAVLIntervalTree *t, int when) {
+ *   GenAVLIVIter iter;
+ *   Reservation *r;
+ *
+ *   for (r = GenAVLIVIterInitStabData(&iter, t, &when); r != 0;
+ *        r = GenAVLIVIterNextData(&iter)) {
+ *     DoSomething(r);
+ *   }
+ *
+ * Note that there is no protection against additions and
+ * deletions to the tree while an iterator is operating on it
+ *
+ ***************************************************************/
+typedef struct GENAVLINTERVALTREE {
+  GenAVLTree tree;
+  int (*EndCompare)(GenAVLEntry*, const void*);
+  int (*MaxEndCompare)(GenAVLEntry*, const void*);
+} GenAVLIntervalTree;
+
+typedef struct {
+  GenAVLEntry* stack[MAX_GENAVL_STACK];
+  int sp;
+  GenAVLIntervalTree* ivtp;
+  const void* lo;
+  const void* hi;
+  int stab;
+} GenAVLIVIter;
+void* GenAVLIVIterInitStabData(GenAVLIVIter*,
+                               GenAVLIntervalTree*,
+                               const void*);
+void* GenAVLIVIterInitOverlapData(GenAVLIVIter*,
+                                  GenAVLIntervalTree*,
+                                  const void*,
+                                  const void*);
+void* GenAVLIVIterNextData(GenAVLIVIter*);
+#endif
 
 /***************************************************************
  *
@@ -232,6 +805,15 @@ void* GenAVLDFIterNextData(GenAVLDFIter*);
  *     DoSomething(data);
  *   }
  *
+ * Nodes come out level by level, left to right, so adding them
+ * in that order to an empty tree rebuilds the same shape without
+ * any rotations. GenAVLBFIterInitLevelsData stops after the given
+ * number of levels, which is handy for warming caches with the
+ * top of the tree.
+ *
+ * Each level is found by a depth-first walk which skips subtrees
+ * too short to reach it, so no queue is needed.
+ *
  * Note that there is no protection against additions and
  * deletions to the tree while an iterator is operating on it
  *
@@ -242,8 +824,12 @@ typedef struct {
   int sp;
   int maxdepth;
   GenAVLEntry* root;
+  int levels;
+  int height;
+  int ht;
 } GenAVLBFIter;
 void* GenAVLBFIterInitData(GenAVLBFIter*, GenAVLTree*);
+void* GenAVLBFIterInitLevelsData(GenAVLBFIter*, GenAVLTree*, int);
 void* GenAVLBFIterNextData(GenAVLBFIter*);
 
 #ifdef __cplusplus
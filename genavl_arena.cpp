@@ -0,0 +1,403 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdint.h>
+
+#include <thread>
+
+#include "genavl_arena.h"
+
+#define GENAVL_ARENA_MAGIC 0x416c7641
+
+/*******************************************************
+ *
+ * Round a size up to the arena alignment
+ *
+ *******************************************************/
+static size_t GenAVLArenaRound(size_t n) {
+  return (n + GENAVL_ARENA_ALIGN - 1) & ~(size_t)(GENAVL_ARENA_ALIGN - 1);
+}
+
+/*******************************************************
+ *
+ * Return the size class for a block of n bytes, or -1
+ * if it is larger than GENAVL_ARENA_MAX
+ *
+ *******************************************************/
+static int GenAVLArenaClass(size_t n) {
+  size_t s;
+  int c;
+
+  if (n <= 256)
+    return n ? (int)((n + 15) >> 4) - 1 : 0;
+  for (c = 16, s = 512; s < n; s <<= 1)
+    c++;
+  return c < GENAVL_ARENA_CLASSES ? c : -1;
+}
+
+/*******************************************************
+ *
+ * Return the size of the blocks of a class
+ *
+ *******************************************************/
+static size_t GenAVLArenaClassSize(int c) {
+  return c < 16 ? (size_t)(c + 1) << 4 : (size_t)512 << (c - 16);
+}
+
+/*******************************************************
+ *
+ * Take and drop the arena's spin lock
+ *
+ *******************************************************/
+static void GenAVLArenaLock(GenAVLArena* gaap) {
+  while (__atomic_exchange_n(&gaap->lock, 1, __ATOMIC_ACQUIRE))
+    while (__atomic_load_n(&gaap->lock, __ATOMIC_RELAXED))
+      std::this_thread::yield();
+}
+
+static void GenAVLArenaUnlock(GenAVLArena* gaap) {
+  __atomic_store_n(&gaap->lock, 0, __ATOMIC_RELEASE);
+}
+
+/*******************************************************
+ *
+ * Carve n bytes off the unused end of the region. The
+ * lock must be held.
+ *
+ *******************************************************/
+static void* GenAVLArenaBump(GenAVLArena* gaap, size_t n) {
+  char* p;
+
+  if (gaap->size - gaap->top < n)
+    return 0;
+  p = (char*)gaap + gaap->top;
+  gaap->top += n;
+  return p;
+}
+
+/*******************************************************
+ *
+ * Set up an arena at the start of the region of size
+ * bytes at base, returning it, or 0 if the region is
+ * misaligned or too small to hold the arena
+ *
+ *******************************************************/
+GenAVLArena* GenAVLArenaInit(void* base, size_t size) {
+  GenAVLArena* gaap = (GenAVLArena*)base;
+  int c;
+
+  if (((uintptr_t)base & (GENAVL_ARENA_ALIGN - 1)) ||
+      size < GenAVLArenaRound(sizeof(GenAVLArena)))
+    return 0;
+  gaap->lock = 0;
+  gaap->size = size;
+  gaap->top = GenAVLArenaRound(sizeof(GenAVLArena));
+  for (c = 0; c < GENAVL_ARENA_CLASSES; c++)
+    gaap->free[c] = 0;
+  gaap->chunks = 0;
+  gaap->magic = GENAVL_ARENA_MAGIC;
+  return gaap;
+}
+
+/*******************************************************
+ *
+ * Return the arena at the start of a region set up by
+ * GenAVLArenaInit, possibly in another process, or 0 if
+ * there is none
+ *
+ *******************************************************/
+GenAVLArena* GenAVLArenaAttach(void* base) {
+  GenAVLArena* gaap = (GenAVLArena*)base;
+
+  return gaap->magic == GENAVL_ARENA_MAGIC ? gaap : 0;
+}
+
+/*******************************************************
+ *
+ * Extend the arena's region to size bytes from its
+ * start. The region must already be that large.
+ *
+ *******************************************************/
+void GenAVLArenaGrow(GenAVLArena* gaap, size_t size) {
+  GenAVLArenaLock(gaap);
+  if (size > gaap->size)
+    gaap->size = size;
+  GenAVLArenaUnlock(gaap);
+}
+
+/*******************************************************
+ *
+ * Allocate a block of at least n bytes from the arena
+ *
+ *******************************************************/
+void* GenAVLArenaAlloc(GenAVLArena* gaap, size_t n) {
+  GenAVLArenaBlock* gabp;
+  int c = GenAVLArenaClass(n);
+
+  if (c < 0)
+    return 0;
+  GenAVLArenaLock(gaap);
+  if ((gabp = gaap->free[c]))
+    gaap->free[c] = gabp->next;
+  else
+    gabp = (GenAVLArenaBlock*)GenAVLArenaBump(gaap, GenAVLArenaClassSize(c));
+  GenAVLArenaUnlock(gaap);
+  return gabp;
+}
+
+/*******************************************************
+ *
+ * Return a block of n bytes to the arena
+ *
+ *******************************************************/
+void GenAVLArenaFree(GenAVLArena* gaap, void* p, size_t n) {
+  GenAVLArenaBlock* gabp = (GenAVLArenaBlock*)p;
+  int c = GenAVLArenaClass(n);
+
+  if (!gabp || c < 0)
+    return;
+  GenAVLArenaLock(gaap);
+  gabp->next = gaap->free[c];
+  gaap->free[c] = gabp;
+  GenAVLArenaUnlock(gaap);
+}
+
+/*******************************************************
+ *
+ * Start an empty cache on the arena
+ *
+ *******************************************************/
+void GenAVLArenaCacheInit(GenAVLArenaCache* gacp, GenAVLArena* gaap) {
+  int c;
+
+  gacp->arena = gaap;
+  for (c = 0; c < GENAVL_ARENA_CLASSES; c++) {
+    gacp->free[c] = 0;
+    gacp->count[c] = 0;
+  }
+}
+
+/*******************************************************
+ *
+ * Move up to GENAVL_ARENA_BATCH blocks of class c from
+ * the arena to the empty cache, taking them from the
+ * arena's free list if it has any and carving them
+ * from the region if not. Returns the number moved.
+ *
+ *******************************************************/
+static unsigned int GenAVLArenaCacheRefill(GenAVLArenaCache* gacp, int c) {
+  GenAVLArena* gaap = gacp->arena;
+  GenAVLArenaBlock* head;
+  GenAVLArenaBlock* gabp;
+  size_t sz = GenAVLArenaClassSize(c);
+  unsigned int n = 0;
+  unsigned int i;
+  char* p = 0;
+
+  GenAVLArenaLock(gaap);
+  if ((head = gaap->free[c])) {
+    for (gabp = head, n = 1; gabp->next && n < GENAVL_ARENA_BATCH; n++)
+      gabp = gabp->next;
+    gaap->free[c] = gabp->next;
+    gabp->next = 0;
+  } else {
+    for (n = GENAVL_ARENA_BATCH;
+         n && !(p = (char*)GenAVLArenaBump(gaap, n * sz)); n >>= 1)
+      ;
+  }
+  GenAVLArenaUnlock(gaap);
+
+  if (p) {
+    head = (GenAVLArenaBlock*)p;
+    for (i = 1; i < n; i++)
+      ((GenAVLArenaBlock*)(p + (i - 1) * sz))->next =
+          (GenAVLArenaBlock*)(p + i * sz);
+    ((GenAVLArenaBlock*)(p + (n - 1) * sz))->next = 0;
+  }
+  gacp->free[c] = head;
+  gacp->count[c] = n;
+  return n;
+}
+
+/*******************************************************
+ *
+ * Move the first n blocks of class c in the cache back
+ * to the arena
+ *
+ *******************************************************/
+static void GenAVLArenaCacheSpill(GenAVLArenaCache* gacp,
+                                  int c,
+                                  unsigned int n) {
+  GenAVLArena* gaap = gacp->arena;
+  GenAVLArenaBlock* head = gacp->free[c];
+  GenAVLArenaBlock* gabp = head;
+  unsigned int i;
+
+  if (!n)
+    return;
+  for (i = 1; i < n; i++)
+    gabp = gabp->next;
+  gacp->free[c] = gabp->next;
+  gacp->count[c] -= n;
+
+  GenAVLArenaLock(gaap);
+  gabp->next = gaap->free[c];
+  gaap->free[c] = head;
+  GenAVLArenaUnlock(gaap);
+}
+
+/*******************************************************
+ *
+ * Allocate a block of at least n bytes through the
+ * cache
+ *
+ *******************************************************/
+void* GenAVLArenaCacheAlloc(GenAVLArenaCache* gacp, size_t n) {
+  GenAVLArenaBlock* gabp;
+  int c = GenAVLArenaClass(n);
+
+  if (c < 0 || (!gacp->free[c] && !GenAVLArenaCacheRefill(gacp, c)))
+    return 0;
+  gabp = gacp->free[c];
+  gacp->free[c] = gabp->next;
+  gacp->count[c]--;
+  return gabp;
+}
+
+/*******************************************************
+ *
+ * Free a block of n bytes into the cache, handing a
+ * batch back to the arena once the cache holds two
+ *
+ *******************************************************/
+void GenAVLArenaCacheFree(GenAVLArenaCache* gacp, void* p, size_t n) {
+  GenAVLArenaBlock* gabp = (GenAVLArenaBlock*)p;
+  int c = GenAVLArenaClass(n);
+
+  if (!gabp || c < 0)
+    return;
+  gabp->next = gacp->free[c];
+  gacp->free[c] = gabp;
+  if (++gacp->count[c] >= 2 * GENAVL_ARENA_BATCH)
+    GenAVLArenaCacheSpill(gacp, c, GENAVL_ARENA_BATCH);
+}
+
+/*******************************************************
+ *
+ * Return every block held by the cache to the arena
+ *
+ *******************************************************/
+void GenAVLArenaCacheFlush(GenAVLArenaCache* gacp) {
+  int c;
+
+  for (c = 0; c < GENAVL_ARENA_CLASSES; c++)
+    GenAVLArenaCacheSpill(gacp, c, gacp->count[c]);
+}
+
+/*******************************************************
+ *
+ * Start an empty pool on the arena
+ *
+ *******************************************************/
+void GenAVLPoolInit(GenAVLPool* gapp, GenAVLArena* gaap) {
+  int c;
+
+  gapp->arena = gaap;
+  gapp->head = 0;
+  gapp->tail = 0;
+  for (c = 0; c < GENAVL_ARENA_CLASSES; c++)
+    gapp->free[c] = 0;
+  gapp->used = GENAVL_ARENA_CHUNK;
+}
+
+/*******************************************************
+ *
+ * Allocate a block of at least n bytes from the pool,
+ * reusing one freed to it or else carving it from the
+ * newest chunk. Each chunk starts with the link to the
+ * one before it.
+ *
+ *******************************************************/
+void* GenAVLPoolAlloc(GenAVLPool* gapp, size_t n) {
+  GenAVLArena* gaap = gapp->arena;
+  GenAVLArenaBlock* gabp;
+  size_t sz;
+  int c = GenAVLArenaClass(n);
+
+  if (c < 0)
+    return 0;
+  if ((gabp = gapp->free[c])) {
+    gapp->free[c] = gabp->next;
+    return gabp;
+  }
+
+  sz = GenAVLArenaClassSize(c);
+  if (GENAVL_ARENA_CHUNK - gapp->used < sz) {
+    GenAVLArenaLock(gaap);
+    if ((gabp = gaap->chunks))
+      gaap->chunks = gabp->next;
+    else
+      gabp = (GenAVLArenaBlock*)GenAVLArenaBump(gaap, GENAVL_ARENA_CHUNK);
+    GenAVLArenaUnlock(gaap);
+    if (!gabp)
+      return 0;
+    gabp->next = gapp->head;
+    gapp->head = gabp;
+    if (!gapp->tail)
+      gapp->tail = gabp;
+    gapp->used = GenAVLArenaRound(sizeof(GenAVLArenaBlock));
+  }
+  gabp = (GenAVLArenaBlock*)((char*)(GenAVLArenaBlock*)gapp->head + gapp->used);
+  gapp->used += sz;
+  return gabp;
+}
+
+/*******************************************************
+ *
+ * Return a block of n bytes to the pool for reuse
+ *
+ *******************************************************/
+void GenAVLPoolFree(GenAVLPool* gapp, void* p, size_t n) {
+  GenAVLArenaBlock* gabp = (GenAVLArenaBlock*)p;
+  int c = GenAVLArenaClass(n);
+
+  if (!gabp || c < 0)
+    return;
+  gabp->next = gapp->free[c];
+  gapp->free[c] = gabp;
+}
+
+/*******************************************************
+ *
+ * Hand every chunk of the pool back to the arena by
+ * splicing the pool's chain onto the arena's, leaving
+ * the pool empty
+ *
+ *******************************************************/
+void GenAVLPoolRelease(GenAVLPool* gapp) {
+  GenAVLArena* gaap = gapp->arena;
+
+  if (gapp->head) {
+    GenAVLArenaLock(gaap);
+    gapp->tail->next = gaap->chunks;
+    gaap->chunks = gapp->head;
+    GenAVLArenaUnlock(gaap);
+  }
+  GenAVLPoolInit(gapp, gaap);
+}
@@ -0,0 +1,156 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GENAVL_ARENA_H
+#define GENAVL_ARENA_H
+
+#include "genavl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************************************************
+ *
+ * Arena allocation
+ *
+ * A GenAVLArena manages a region of memory given to it whole,
+ * such as a shared or mapped segment, and hands out blocks of
+ * it for entries and the data they index. Everything the arena
+ * keeps lives inside the region and its free lists are linked
+ * with offset_ptr when USE_OFFSET_PTR is defined, so the region
+ * may be mapped at a different address in each process. The
+ * arena sits at the start of the region, which must be aligned
+ * to GENAVL_ARENA_ALIGN; GenAVLArenaAttach checks and returns
+ * it from the base address of a region already set up.
+ * GenAVLArenaGrow tells it the region now extends further, as
+ * when the file behind a mapping has been lengthened.
+ *
+ * Sizes are rounded up to one of GENAVL_ARENA_CLASSES size
+ * classes: multiples of 16 bytes up to 256, then powers of two
+ * up to GENAVL_ARENA_MAX. Larger blocks are not supplied, and
+ * the size must be given again when a block is freed.
+ *
+ * GenAVLArenaAlloc and GenAVLArenaFree take the arena's lock on
+ * every call. The lock is a spin lock kept in the region, so it
+ * holds across processes sharing it as well as across threads.
+ * A thread doing many of them should keep its own
+ * GenAVLArenaCache, which moves blocks to and from the arena
+ * GENAVL_ARENA_BATCH at a time and otherwise does not lock. A
+ * cache belongs to one thread and must be flushed before it
+ * goes away, or its blocks are lost to the arena.
+ *
+ * A GenAVLPool takes chunks of GENAVL_ARENA_CHUNK bytes from
+ * the arena and allocates from them alone. GenAVLPoolRelease
+ * returns all of its chunks to the arena at once, in constant
+ * time, so the nodes and data of a tree built from a pool can
+ * be thrown away together without visiting them. A pool is not
+ * locked and belongs to one thread, or to whoever holds the
+ * lock of its tree; it may itself be allocated in the arena.
+ *
+ * void rebuild(GenAVLArena *arena, GenAVLPool *pool,
+ *              GenAVLTree *tree) {
+ *   MyData *data;
+ *
+ *   GenAVLPoolRelease(pool);
+ *   tree->root = 0;
+ *   while ((data = NextRecord(GenAVLPoolAlloc(pool,
+ *                                             sizeof(MyData)))))
+ *     GenAVLTreeAdd(tree, &data->entry);
+ * }
+ *
+ * Every call returns 0 when the region is exhausted.
+ *
+ ***************************************************************/
+#define GENAVL_ARENA_ALIGN 16
+#define GENAVL_ARENA_CLASSES 20
+#define GENAVL_ARENA_MAX 4096
+#define GENAVL_ARENA_BATCH 32
+#define GENAVL_ARENA_CHUNK 65536
+
+typedef struct GENAVLARENABLOCK {
+#if defined(USE_OFFSET_PTR)
+  offset_ptr<struct GENAVLARENABLOCK> next;
+#else
+  struct GENAVLARENABLOCK* next;
+#endif
+} GenAVLArenaBlock;
+
+typedef struct GENAVLARENA {
+  unsigned int magic;
+  volatile int lock;
+  size_t size;
+  size_t top;
+#if defined(USE_OFFSET_PTR)
+  offset_ptr<GenAVLArenaBlock> free[GENAVL_ARENA_CLASSES];
+  offset_ptr<GenAVLArenaBlock> chunks;
+#else
+  GenAVLArenaBlock* free[GENAVL_ARENA_CLASSES];
+  GenAVLArenaBlock* chunks;
+#endif
+} GenAVLArena;
+
+typedef struct {
+#if defined(USE_OFFSET_PTR)
+  offset_ptr<GenAVLArena> arena;
+  offset_ptr<GenAVLArenaBlock> free[GENAVL_ARENA_CLASSES];
+#else
+  GenAVLArena* arena;
+  GenAVLArenaBlock* free[GENAVL_ARENA_CLASSES];
+#endif
+  unsigned int count[GENAVL_ARENA_CLASSES];
+} GenAVLArenaCache;
+
+typedef struct {
+#if defined(USE_OFFSET_PTR)
+  offset_ptr<GenAVLArena> arena;
+  offset_ptr<GenAVLArenaBlock> head;
+  offset_ptr<GenAVLArenaBlock> tail;
+  offset_ptr<GenAVLArenaBlock> free[GENAVL_ARENA_CLASSES];
+#else
+  GenAVLArena* arena;
+  GenAVLArenaBlock* head;
+  GenAVLArenaBlock* tail;
+  GenAVLArenaBlock* free[GENAVL_ARENA_CLASSES];
+#endif
+  size_t used;
+} GenAVLPool;
+
+GenAVLArena* GenAVLArenaInit(void*, size_t);
+GenAVLArena* GenAVLArenaAttach(void*);
+void GenAVLArenaGrow(GenAVLArena*, size_t);
+void* GenAVLArenaAlloc(GenAVLArena*, size_t);
+void GenAVLArenaFree(GenAVLArena*, void*, size_t);
+
+void GenAVLArenaCacheInit(GenAVLArenaCache*, GenAVLArena*);
+void* GenAVLArenaCacheAlloc(GenAVLArenaCache*, size_t);
+void GenAVLArenaCacheFree(GenAVLArenaCache*, void*, size_t);
+void GenAVLArenaCacheFlush(GenAVLArenaCache*);
+
+void GenAVLPoolInit(GenAVLPool*, GenAVLArena*);
+void* GenAVLPoolAlloc(GenAVLPool*, size_t);
+void GenAVLPoolFree(GenAVLPool*, void*, size_t);
+void GenAVLPoolRelease(GenAVLPool*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GENAVL_ARENA_H */
@@ -0,0 +1,360 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GENAVL_COMPACT_H
+#define GENAVL_COMPACT_H
+
+#include <cassert>
+#include <cstdint>
+
+#include "genavl_tree.h"
+
+/***************************************************************
+ *
+ * Compact nodes
+ *
+ * A GenAVLEntry is 32 bytes with USE_OFFSET_PTR. The compact
+ * trees here run the same algorithms from genavl_tree.h over
+ * smaller nodes whose links are 32-bit offsets from the base
+ * of a segment given to the tree, such as the region of a
+ * GenAVLArena:
+ *
+ *   compact_entry - 12 bytes: left, right and data links. The
+ *   node is separate from the object it indexes.
+ *
+ *   compact_hook - 8 bytes: left and right links only. The node
+ *   is embedded in the object, which is found from the hook's
+ *   offset, so no data link is needed.
+ *
+ * A link holds the offset from the segment base plus 4, so a
+ * link of 0 is null. Nodes lie at offsets which are multiples
+ * of 4, so the low two bits of each left and right link are
+ * free. The balance, which reaches -2 or 2 for a moment during
+ * rebalancing, is kept in three of those bits.
+ *
+ * The segment is at most GENAVL_COMPACT_SEGMENT_MAX bytes, and
+ * every node and every object indexed must lie wholly within
+ * it: insert returns false for any that does not. Like
+ * offset_ptr, the offsets are unaffected by where the segment
+ * is mapped; if it moves, tell the tree with set_segment. The
+ * tree's root is an offset_ptr, as in GenAVLTree, so the tree
+ * itself can be anywhere.
+ *
+ * Trees of compact nodes are used through the typed front-ends
+ * genavl::compact_tree and genavl::compact_hook_tree, which
+ * follow genavl::tree:
+ *
+ * struct MyData {
+ *   int key;
+ *   genavl::compact_hook hook;
+ * };
+ * struct MyKey {
+ *   const int& operator()(const MyData& d) const { return d.key; }
+ * };
+ *
+ * genavl::compact_hook_tree<MyData, &MyData::hook, MyKey> t(arena,
+ *                                                       arena->size);
+ * t.insert(*data);
+ * MyData *found = t.find(10);
+ *
+ * The compact nodes keep no counts and have no Augment hook or
+ * parent link, so USE_GENAVL_COUNT and USE_GENAVL_PARENT do not
+ * apply to them, and they cannot be used with the C calls.
+ *
+ ***************************************************************/
+#define GENAVL_COMPACT_SEGMENT_MAX 0xfffffff8u
+
+namespace genavl {
+
+struct compact_hook {
+  uint32_t left;
+  uint32_t right;
+};
+
+struct compact_entry : compact_hook {
+  uint32_t data;
+};
+
+static_assert(sizeof(compact_hook) == 8, "compact_hook must be 8 bytes");
+static_assert(sizeof(compact_entry) == 12, "compact_entry must be 12 bytes");
+
+namespace detail {
+
+/* A segment of at most GENAVL_COMPACT_SEGMENT_MAX bytes */
+struct compact_segment {
+  char* base;
+  size_t size;
+
+  compact_segment(void* b, size_t s) : base(static_cast<char*>(b)), size(s) {
+    assert(size <= GENAVL_COMPACT_SEGMENT_MAX);
+  }
+
+  /* True if the n bytes at p lie within the segment */
+  bool holds(const void* p, size_t n) const {
+    const char* c = static_cast<const char*>(p);
+    return c >= base && n <= size && (size_t)(c - base) <= size - n;
+  }
+
+  /* The link to p, or 0 for null. p must lie within the segment. */
+  uint32_t link(const void* p) const {
+    return p ? static_cast<uint32_t>(static_cast<const char*>(p) - base) + 4
+             : 0;
+  }
+  void* target(uint32_t l) const { return l ? base + l - 4 : 0; }
+};
+
+/***************************************************************
+ *
+ * Node and root access for compact nodes. Access gives the
+ * object for a node, from which KeyOf and Less give the
+ * ordering.
+ *
+ ***************************************************************/
+template <class Access, class KeyOf, class Less>
+struct compact_policy {
+  typedef compact_hook* node_ptr;
+  typedef typename Access::value_type value_type;
+  typedef decltype(std::declval<KeyOf>()(std::declval<const value_type&>()))
+      key_result;
+  typedef const typename std::decay<key_result>::type& key_type;
+
+#if defined(USE_OFFSET_PTR)
+  typedef offset_ptr<compact_hook> root_type;
+#else
+  typedef compact_hook* root_type;
+#endif
+
+  root_type* rootp;
+  compact_segment seg;
+
+  compact_policy(root_type* r, const compact_segment& s) : rootp(r), seg(s) {}
+
+  node_ptr root() const { return *rootp; }
+  void set_root(node_ptr n) { *rootp = n; }
+  node_ptr left(node_ptr n) const {
+    return static_cast<node_ptr>(seg.target(n->left & ~3u));
+  }
+  node_ptr right(node_ptr n) const {
+    return static_cast<node_ptr>(seg.target(n->right & ~3u));
+  }
+  void set_left(node_ptr n, node_ptr c) {
+    assert(!c || seg.holds(c, sizeof(compact_hook)));
+    n->left = seg.link(c) | (n->left & 3);
+  }
+  void set_right(node_ptr n, node_ptr c) {
+    assert(!c || seg.holds(c, sizeof(compact_hook)));
+    n->right = seg.link(c) | (n->right & 3);
+  }
+
+  /* balance + 2 has its low two bits in left and the third in right */
+  int balance(node_ptr n) const {
+    return (int)((n->left & 3) | ((n->right & 1) << 2)) - 2;
+  }
+  void set_balance(node_ptr n, int b) {
+    b += 2;
+    n->left = (n->left & ~3u) | (b & 3);
+    n->right = (n->right & ~3u) | (b >> 2);
+  }
+  void init(node_ptr n) {
+    n->left = 0;
+    n->right = 0;
+    set_balance(n, 0);
+  }
+  void fix(node_ptr) {}
+
+  key_result key(node_ptr n) const { return KeyOf()(*Access::get(seg, n)); }
+  int compare(node_ptr n, key_type k) const {
+    key_type nk = key(n);
+    if (Less()(nk, k))
+      return -1;
+    return Less()(k, nk) ? 1 : 0;
+  }
+};
+
+/* Objects reached through the data link of a compact_entry */
+template <class T>
+struct compact_data_access {
+  typedef T value_type;
+
+  static T* get(const compact_segment& seg, compact_hook* n) {
+    compact_entry* e = static_cast<compact_entry*>(n);
+    return e ? static_cast<T*>(seg.target(e->data)) : 0;
+  }
+};
+
+/* Objects which embed their compact_hook */
+template <class T, compact_hook T::*Hook>
+struct compact_hook_access {
+  typedef T value_type;
+
+  static std::ptrdiff_t hook_offset() {
+    return reinterpret_cast<const char*>(
+               &(reinterpret_cast<const T*>(0x1000)->*Hook)) -
+           reinterpret_cast<const char*>(0x1000);
+  }
+  static T* get(const compact_segment&, compact_hook* n) {
+    return n ? reinterpret_cast<T*>(reinterpret_cast<char*>(n) - hook_offset())
+             : 0;
+  }
+};
+
+/***************************************************************
+ *
+ * The operations shared by the compact front-ends
+ *
+ ***************************************************************/
+template <class Access, class KeyOf, class Less>
+class compact_tree_base {
+ public:
+  typedef typename Access::value_type value_type;
+  typedef typename std::decay<decltype(std::declval<KeyOf>()(
+      std::declval<const value_type&>()))>::type key_type;
+
+  /* An empty tree over the segment of size bytes at base */
+  compact_tree_base(void* base, size_t size) : seg_(base, size) { root_ = 0; }
+
+  bool empty() const { return !root_; }
+
+  /* The segment has moved or grown */
+  void set_segment(void* base, size_t size) {
+    seg_ = detail::compact_segment(base, size);
+  }
+
+  /* Remove and return the object with the given key or 0 */
+  value_type* erase(const key_type& k) {
+    policy p(&root_, seg_);
+    return Access::get(seg_, detail::erase(p, k));
+  }
+
+  value_type* find(const key_type& k) {
+    policy p(&root_, seg_);
+    return Access::get(seg_, detail::find(p, k));
+  }
+  value_type* first() {
+    policy p(&root_, seg_);
+    return Access::get(seg_, detail::first(p));
+  }
+  value_type* next(const key_type& k) {
+    policy p(&root_, seg_);
+    return Access::get(seg_, detail::next(p, k));
+  }
+  value_type* equal_next(const key_type& k) {
+    policy p(&root_, seg_);
+    return Access::get(seg_, detail::equal_next(p, k));
+  }
+  value_type* prev(const key_type& k) {
+    policy p(&root_, seg_);
+    return Access::get(seg_, detail::prev(p, k));
+  }
+  value_type* equal_prev(const key_type& k) {
+    policy p(&root_, seg_);
+    return Access::get(seg_, detail::equal_prev(p, k));
+  }
+
+ protected:
+  typedef compact_policy<Access, KeyOf, Less> policy;
+
+  /* True if the node can be linked: within the segment at an
+   * offset with the low two bits free for the balance */
+  bool reaches(compact_hook* n, size_t size) const {
+    return seg_.holds(n, size) &&
+           ((reinterpret_cast<char*>(n) - seg_.base) & 3) == 0;
+  }
+
+  bool insert_node(compact_hook* n) {
+    policy p(&root_, seg_);
+    return detail::add(p, n) != 0;
+  }
+
+  typename policy::root_type root_;
+  detail::compact_segment seg_;
+
+ private:
+  compact_tree_base(const compact_tree_base&);
+  compact_tree_base& operator=(const compact_tree_base&);
+};
+
+}  // namespace detail
+
+/***************************************************************
+ *
+ * genavl::compact_tree indexes objects of type T through
+ * separate 12-byte compact_entry nodes
+ *
+ ***************************************************************/
+template <class T,
+          class KeyOf,
+          class Less = std::less<typename std::decay<
+              decltype(std::declval<KeyOf>()(std::declval<const T&>()))>::type> >
+class compact_tree
+    : public detail::compact_tree_base<detail::compact_data_access<T>,
+                                       KeyOf,
+                                       Less> {
+  typedef detail::compact_tree_base<detail::compact_data_access<T>, KeyOf, Less>
+      base_type;
+
+ public:
+  compact_tree(void* base, size_t size) : base_type(base, size) {}
+
+  /* Add the object through the given node, returns false if the key is
+   * already present or the node or object is outside the segment */
+  bool insert(compact_entry& e, T& t) {
+    if (!this->reaches(&e, sizeof(e)) || !this->seg_.holds(&t, sizeof(t)))
+      return false;
+    e.data = this->seg_.link(&t);
+    return this->insert_node(&e);
+  }
+};
+
+/***************************************************************
+ *
+ * genavl::compact_hook_tree indexes objects of type T which
+ * embed an 8-byte compact_hook member (Hook)
+ *
+ ***************************************************************/
+template <class T,
+          compact_hook T::*Hook,
+          class KeyOf,
+          class Less = std::less<typename std::decay<
+              decltype(std::declval<KeyOf>()(std::declval<const T&>()))>::type> >
+class compact_hook_tree
+    : public detail::compact_tree_base<detail::compact_hook_access<T, Hook>,
+                                       KeyOf,
+                                       Less> {
+  typedef detail::
+      compact_tree_base<detail::compact_hook_access<T, Hook>, KeyOf, Less>
+          base_type;
+
+ public:
+  compact_hook_tree(void* base, size_t size) : base_type(base, size) {}
+
+  /* Add the object, returns false if the key is already present or
+   * the object is outside the segment */
+  bool insert(T& t) {
+    if (!this->reaches(&(t.*Hook), sizeof(compact_hook)) ||
+        !this->seg_.holds(&t, sizeof(t)))
+      return false;
+    return this->insert_node(&(t.*Hook));
+  }
+};
+
+}  // namespace genavl
+
+#endif /* GENAVL_COMPACT_H */
@@ -0,0 +1,996 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <thread>
+
+#include "genavl_conc.h"
+
+/* Version bits: a node is unlinked for good, or is being moved
+ * down by a rotation; each rotation adds GENAVL_CONC_SHRINK */
+#define GENAVL_CONC_UNLINKED 1ul
+#define GENAVL_CONC_SHRINKING 2ul
+#define GENAVL_CONC_SHRINK 4ul
+#define GENAVL_CONC_CHANGING (GENAVL_CONC_UNLINKED | GENAVL_CONC_SHRINKING)
+
+/* What a node needs, as found by GenAVLConcCondition; a
+ * height of 0 or more means it needs only its height set */
+#define GENAVL_CONC_UNLINK -1
+#define GENAVL_CONC_REBALANCE -2
+#define GENAVL_CONC_NOTHING -3
+
+#define GENAVL_CONC_SPINS 128
+#define GENAVL_CONC_BATCH 64
+
+typedef GenAVLConcNode Node;
+
+static char GenAVLConcRetryMark;
+#define GENAVL_CONC_RETRY ((void*)&GenAVLConcRetryMark)
+
+/*******************************************************
+ *
+ * Node fields are read and written atomically, links
+ * and versions with acquire and release so that a
+ * version read after a link is at least as new as the
+ * rotation that stored the link
+ *
+ *******************************************************/
+static inline Node* Child(Node* n, int dir) {
+  return __atomic_load_n(dir < 0 ? &n->left : &n->right, __ATOMIC_ACQUIRE);
+}
+
+static inline void SetChild(Node* n, int dir, Node* c) {
+  __atomic_store_n(dir < 0 ? &n->left : &n->right, c, __ATOMIC_RELEASE);
+}
+
+static inline Node* Parent(Node* n) {
+  return __atomic_load_n(&n->parent, __ATOMIC_ACQUIRE);
+}
+
+static inline void SetParent(Node* n, Node* p) {
+  __atomic_store_n(&n->parent, p, __ATOMIC_RELEASE);
+}
+
+static inline unsigned long Version(Node* n) {
+  return __atomic_load_n(&n->version, __ATOMIC_ACQUIRE);
+}
+
+static inline void SetVersion(Node* n, unsigned long v) {
+  __atomic_store_n(&n->version, v, __ATOMIC_RELEASE);
+}
+
+static inline int Height(Node* n) {
+  return n ? __atomic_load_n(&n->height, __ATOMIC_RELAXED) : 0;
+}
+
+static inline void SetHeight(Node* n, int h) {
+  __atomic_store_n(&n->height, h, __ATOMIC_RELAXED);
+}
+
+static inline void* Value(Node* n) {
+  return __atomic_load_n(&n->value, __ATOMIC_ACQUIRE);
+}
+
+static inline void SetValue(Node* n, void* v) {
+  __atomic_store_n(&n->value, v, __ATOMIC_RELEASE);
+}
+
+static inline void Lock(Node* n) {
+  int spins = 0;
+
+  while (__atomic_exchange_n(&n->lock, 1, __ATOMIC_ACQUIRE))
+    while (__atomic_load_n(&n->lock, __ATOMIC_RELAXED))
+      if (++spins % GENAVL_CONC_SPINS == 0)
+        std::this_thread::yield();
+}
+
+static inline void Unlock(Node* n) {
+  __atomic_store_n(&n->lock, 0, __ATOMIC_RELEASE);
+}
+
+/*******************************************************
+ *
+ * Compare the key with that of the node: -1 if the key
+ * is less, so lies to the left, 1 if greater, 0 if equal
+ *
+ *******************************************************/
+static inline int GenAVLConcCompare(GenAVLConc* gacp,
+                                    const void* key,
+                                    Node* n) {
+  int c = gacp->tree.Compare(&n->entry, key);
+
+  return c < 0 ? 1 : c > 0 ? -1 : 0;
+}
+
+/*******************************************************
+ *
+ * Wait for a rotation moving the node to finish. It
+ * holds the lock, so after a short spin take that.
+ *
+ *******************************************************/
+static void GenAVLConcWait(Node* n) {
+  unsigned long v = Version(n);
+  int i;
+
+  if (!(v & GENAVL_CONC_SHRINKING))
+    return;
+  for (i = 0; i < GENAVL_CONC_SPINS; i++)
+    if (Version(n) != v)
+      return;
+  Lock(n);
+  Unlock(n);
+}
+
+/***************************************************************
+ *
+ * Reclamation
+ *
+ * A thread marks its slot with the epoch while it is within a
+ * call. What it unlinks it tags with the epoch read after the
+ * unlink and keeps in the bucket for that tag: nodes chained
+ * through next, which no search reads, and data in an array. The
+ * epoch moves on only when every thread within a call has marked
+ * it, so once it is two past a tag every thread that could have
+ * reached what was unlinked has left, and the bucket can be
+ * freed.
+ *
+ ***************************************************************/
+static void GenAVLConcFreeBucket(GenAVLConc* gacp,
+                                 GenAVLConcSlot* gacsp,
+                                 int b) {
+  Node* n;
+  Node* next;
+  size_t i;
+
+  for (n = gacsp->nodes[b]; n; n = next) {
+    next = n->next;
+    if (gacp->Free)
+      gacp->Free((void*)n->entry.data);
+    free(n);
+  }
+  gacsp->nodes[b] = 0;
+  for (i = 0; i < gacsp->ndata[b]; i++)
+    if (gacp->Free)
+      gacp->Free(gacsp->data[b][i]);
+  gacsp->ndata[b] = 0;
+}
+
+/*******************************************************
+ *
+ * Move the epoch on if every thread within a call has
+ * marked the current one
+ *
+ *******************************************************/
+static void GenAVLConcAdvance(GenAVLConc* gacp) {
+  unsigned long e = __atomic_load_n(&gacp->epoch, __ATOMIC_ACQUIRE);
+  unsigned long m;
+  int i;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (i = 0; i < GENAVL_CONC_THREADS; i++) {
+    m = __atomic_load_n(&gacp->slots[i].epoch, __ATOMIC_ACQUIRE);
+    if (m && m != e)
+      return;
+  }
+  __atomic_compare_exchange_n(&gacp->epoch, &e, e + 1, 0, __ATOMIC_ACQ_REL,
+                              __ATOMIC_RELAXED);
+}
+
+/*******************************************************
+ *
+ * Return the bucket for the epoch, now that something
+ * has been unlinked, emptying it first if it still
+ * holds what was tagged three epochs before
+ *
+ *******************************************************/
+static int GenAVLConcBucket(GenAVLConc* gacp, GenAVLConcSlot* gacsp) {
+  unsigned long e;
+  int b;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  e = __atomic_load_n(&gacp->epoch, __ATOMIC_ACQUIRE);
+  b = (int)(e % 3);
+  if (gacsp->tag[b] != e) {
+    GenAVLConcFreeBucket(gacp, gacsp, b);
+    gacsp->tag[b] = e;
+  }
+  gacsp->nretired++;
+  return b;
+}
+
+static void GenAVLConcRetireNode(GenAVLConc* gacp, int slot, Node* n) {
+  GenAVLConcSlot* gacsp = &gacp->slots[slot];
+  int b = GenAVLConcBucket(gacp, gacsp);
+
+  n->next = gacsp->nodes[b];
+  gacsp->nodes[b] = n;
+}
+
+/*******************************************************
+ *
+ * Hold deleted data until no thread can reach it. If
+ * there is no memory to note it, it is left pending
+ * and freed when the thread leaves its call.
+ *
+ *******************************************************/
+static void GenAVLConcRetireData(GenAVLConc* gacp, int slot, void* p) {
+  GenAVLConcSlot* gacsp = &gacp->slots[slot];
+  int b = GenAVLConcBucket(gacp, gacsp);
+  void** v;
+  size_t n;
+
+  if (gacsp->ndata[b] == gacsp->maxdata[b]) {
+    n = gacsp->maxdata[b] ? 2 * gacsp->maxdata[b] : GENAVL_CONC_BATCH;
+    if (!(v = (void**)realloc(gacsp->data[b], n * sizeof(*v)))) {
+      gacsp->pending = p;
+      gacsp->pendingtag = gacsp->tag[b];
+      return;
+    }
+    gacsp->data[b] = v;
+    gacsp->maxdata[b] = n;
+  }
+  gacsp->data[b][gacsp->ndata[b]++] = p;
+}
+
+/*******************************************************
+ *
+ * Enter a call or read lock, marking the slot with the
+ * epoch and freeing what it holds that is now safe
+ *
+ *******************************************************/
+void GenAVLConcReadLock(GenAVLConc* gacp, int slot) {
+  GenAVLConcSlot* gacsp = &gacp->slots[slot];
+  unsigned long e;
+  int b;
+
+  if (gacsp->depth++)
+    return;
+  e = __atomic_load_n(&gacp->epoch, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&gacsp->epoch, e, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (b = 0; b < 3; b++)
+    if (gacsp->tag[b] + 2 <= e)
+      GenAVLConcFreeBucket(gacp, gacsp, b);
+}
+
+/*******************************************************
+ *
+ * Leave a call or read lock, trying to move the epoch
+ * on if much is waiting to be freed. Data that could
+ * not be held is freed here, once the epoch has moved
+ * on far enough.
+ *
+ *******************************************************/
+void GenAVLConcReadUnlock(GenAVLConc* gacp, int slot) {
+  GenAVLConcSlot* gacsp = &gacp->slots[slot];
+
+  if (--gacsp->depth)
+    return;
+  __atomic_store_n(&gacsp->epoch, 0, __ATOMIC_RELEASE);
+  if (gacsp->pending) {
+    while (__atomic_load_n(&gacp->epoch, __ATOMIC_ACQUIRE) <
+           gacsp->pendingtag + 2) {
+      GenAVLConcAdvance(gacp);
+      std::this_thread::yield();
+    }
+    if (gacp->Free)
+      gacp->Free(gacsp->pending);
+    gacsp->pending = 0;
+  }
+  if (gacsp->nretired >= GENAVL_CONC_BATCH) {
+    gacsp->nretired = 0;
+    GenAVLConcAdvance(gacp);
+  }
+}
+
+/*******************************************************
+ *
+ * Set up an empty tree with the methods of the tree
+ * given, calling Free for data once it is deleted and
+ * no thread can reach it
+ *
+ *******************************************************/
+void GenAVLConcInit(GenAVLConc* gacp,
+                    GenAVLTree* methods,
+                    void (*Free)(void*)) {
+  GenAVLConcSlot* gacsp;
+  int i;
+  int b;
+
+  memcpy((void*)&gacp->tree, (void*)methods, sizeof(GenAVLTree));
+  gacp->tree.root = 0;
+  gacp->Free = Free;
+  memset((void*)&gacp->holder, 0, sizeof(Node));
+  gacp->epoch = 1;
+  for (i = 0; i < GENAVL_CONC_THREADS; i++) {
+    gacsp = &gacp->slots[i];
+    gacsp->epoch = 0;
+    gacsp->used = 0;
+    gacsp->depth = 0;
+    gacsp->nretired = 0;
+    gacsp->pending = 0;
+    for (b = 0; b < 3; b++) {
+      gacsp->tag[b] = 0;
+      gacsp->nodes[b] = 0;
+      gacsp->data[b] = 0;
+      gacsp->ndata[b] = 0;
+      gacsp->maxdata[b] = 0;
+    }
+  }
+}
+
+/*******************************************************
+ *
+ * Free the nodes of a subtree, and the data deleted
+ * whose keys they still hold
+ *
+ *******************************************************/
+static void GenAVLConcFreeTree(GenAVLConc* gacp, Node* n) {
+  if (!n)
+    return;
+  GenAVLConcFreeTree(gacp, n->left);
+  GenAVLConcFreeTree(gacp, n->right);
+  if (n->value != (void*)n->entry.data && gacp->Free)
+    gacp->Free((void*)n->entry.data);
+  free(n);
+}
+
+/*******************************************************
+ *
+ * Free everything the tree holds. No thread may be in a
+ * call.
+ *
+ *******************************************************/
+void GenAVLConcDestroy(GenAVLConc* gacp) {
+  GenAVLConcSlot* gacsp;
+  int i;
+  int b;
+
+  for (i = 0; i < GENAVL_CONC_THREADS; i++) {
+    gacsp = &gacp->slots[i];
+    for (b = 0; b < 3; b++) {
+      GenAVLConcFreeBucket(gacp, gacsp, b);
+      free(gacsp->data[b]);
+      gacsp->data[b] = 0;
+      gacsp->maxdata[b] = 0;
+    }
+  }
+  GenAVLConcFreeTree(gacp, gacp->holder.right);
+  gacp->holder.right = 0;
+}
+
+/*******************************************************
+ *
+ * Take a free slot, or return -1 if there is none
+ *
+ *******************************************************/
+int GenAVLConcRegister(GenAVLConc* gacp) {
+  int i;
+
+  for (i = 0; i < GENAVL_CONC_THREADS; i++)
+    if (!__atomic_exchange_n(&gacp->slots[i].used, 1, __ATOMIC_ACQ_REL))
+      return i;
+  return -1;
+}
+
+/*******************************************************
+ *
+ * Give back a slot, first waiting until what it holds
+ * can be freed
+ *
+ *******************************************************/
+void GenAVLConcUnregister(GenAVLConc* gacp, int slot) {
+  GenAVLConcSlot* gacsp = &gacp->slots[slot];
+  unsigned long last = 0;
+  int b;
+
+  for (b = 0; b < 3; b++)
+    if ((gacsp->nodes[b] || gacsp->ndata[b]) && gacsp->tag[b] > last)
+      last = gacsp->tag[b];
+  while (last && __atomic_load_n(&gacp->epoch, __ATOMIC_ACQUIRE) < last + 2) {
+    GenAVLConcAdvance(gacp);
+    std::this_thread::yield();
+  }
+  for (b = 0; b < 3; b++)
+    GenAVLConcFreeBucket(gacp, gacsp, b);
+  __atomic_store_n(&gacsp->used, 0, __ATOMIC_RELEASE);
+}
+
+/***************************************************************
+ *
+ * Repair
+ *
+ * Whoever changes a node takes on fixing its height and balance
+ * and those of its ancestors, a step at a time, each step under
+ * the locks of the node and its parent. The functions ending in
+ * Nl are called with those locks held. A height fix hands back
+ * the parent as the next node to look at. A rotation changes
+ * the heights of several nodes at once, each of which may then
+ * be out of balance or an empty node with one child; it pushes
+ * them all on a stack, the lowest last, and Repair looks at each
+ * again, so no damage is left without someone to fix it.
+ *
+ ***************************************************************/
+#define GENAVL_CONC_REPAIR (4 * MAX_GENAVL_STACK)
+
+typedef struct {
+  Node* stack[GENAVL_CONC_REPAIR];
+  int sp;
+} GenAVLConcWork;
+
+static inline void GenAVLConcPush(GenAVLConcWork* w, Node* n) {
+  if (w->sp < GENAVL_CONC_REPAIR)
+    w->stack[w->sp++] = n;
+}
+
+static int GenAVLConcCondition(Node* n) {
+  Node* nL = Child(n, -1);
+  Node* nR = Child(n, 1);
+  int hN;
+  int hL;
+  int hR;
+  int hRepl;
+
+  if ((!nL || !nR) && !Value(n))
+    return GENAVL_CONC_UNLINK;
+  hN = Height(n);
+  hL = Height(nL);
+  hR = Height(nR);
+  hRepl = 1 + (hL > hR ? hL : hR);
+  if (hL - hR < -1 || hL - hR > 1)
+    return GENAVL_CONC_REBALANCE;
+  return hN != hRepl ? hRepl : GENAVL_CONC_NOTHING;
+}
+
+static Node* GenAVLConcFixHeightNl(Node* n) {
+  int c = GenAVLConcCondition(n);
+
+  switch (c) {
+    case GENAVL_CONC_REBALANCE:
+    case GENAVL_CONC_UNLINK:
+      return n;
+    case GENAVL_CONC_NOTHING:
+      return 0;
+    default:
+      SetHeight(n, c);
+      return Parent(n);
+  }
+}
+
+/*******************************************************
+ *
+ * Splice out a node with at most one child, returning 0
+ * if it is no longer a child of the parent or has two
+ * children. The node is retired.
+ *
+ *******************************************************/
+static int GenAVLConcUnlinkNl(GenAVLConc* gacp,
+                              int slot,
+                              Node* nP,
+                              Node* n) {
+  Node* nPL = Child(nP, -1);
+  Node* nPR = Child(nP, 1);
+  Node* nL;
+  Node* nR;
+  Node* s;
+
+  if (nPL != n && nPR != n)
+    return 0;
+  nL = Child(n, -1);
+  nR = Child(n, 1);
+  if (nL && nR)
+    return 0;
+  s = nL ? nL : nR;
+  SetChild(nP, nPL == n ? -1 : 1, s);
+  if (s)
+    SetParent(s, nP);
+  SetVersion(n, GENAVL_CONC_UNLINKED);
+  SetValue(n, 0);
+  GenAVLConcRetireNode(gacp, slot, n);
+  return 1;
+}
+
+/*******************************************************
+ *
+ * Rotate n's child on side d, nC, up into its place. n
+ * is marked as shrinking meanwhile, as searches that
+ * have reached it may be sent the wrong way. hO is the
+ * height of n's other child, hCC that of nC's child on
+ * side d and hCO that of nCO, nC's other child.
+ *
+ *******************************************************/
+static void GenAVLConcRotateNl(GenAVLConcWork* w,
+                               Node* nP,
+                               Node* n,
+                               int d,
+                               Node* nC,
+                               int hO,
+                               int hCC,
+                               Node* nCO,
+                               int hCO) {
+  unsigned long v = Version(n);
+  Node* nPL = Child(nP, -1);
+  int hRepl;
+
+  SetVersion(n, v | GENAVL_CONC_SHRINKING);
+
+  SetChild(n, d, nCO);
+  if (nCO)
+    SetParent(nCO, n);
+  SetChild(nC, -d, n);
+  SetParent(n, nC);
+  SetChild(nP, nPL == n ? -1 : 1, nC);
+  SetParent(nC, nP);
+
+  hRepl = 1 + (hCO > hO ? hCO : hO);
+  SetHeight(n, hRepl);
+  SetHeight(nC, 1 + (hCC > hRepl ? hCC : hRepl));
+
+  SetVersion(n, v + GENAVL_CONC_SHRINK);
+
+  GenAVLConcPush(w, nP);
+  GenAVLConcPush(w, nC);
+  GenAVLConcPush(w, n);
+}
+
+/*******************************************************
+ *
+ * Rotate nCO, the child of nC away from side d, up two
+ * levels into the place of n, nC being n's child on
+ * side d. Both n and nC shrink.
+ *
+ *******************************************************/
+static void GenAVLConcRotateOverNl(GenAVLConcWork* w,
+                                   Node* nP,
+                                   Node* n,
+                                   int d,
+                                   Node* nC,
+                                   int hO,
+                                   int hCC,
+                                   Node* nCO) {
+  unsigned long v = Version(n);
+  unsigned long vC = Version(nC);
+  Node* nPL = Child(nP, -1);
+  Node* nCOC = Child(nCO, d);
+  Node* nCOO = Child(nCO, -d);
+  int hCOC = Height(nCOC);
+  int hCOO = Height(nCOO);
+  int hRepl;
+  int hCRepl;
+
+  SetVersion(n, v | GENAVL_CONC_SHRINKING);
+  SetVersion(nC, vC | GENAVL_CONC_SHRINKING);
+
+  SetChild(n, d, nCOO);
+  if (nCOO)
+    SetParent(nCOO, n);
+  SetChild(nC, -d, nCOC);
+  if (nCOC)
+    SetParent(nCOC, nC);
+  SetChild(nCO, d, nC);
+  SetParent(nC, nCO);
+  SetChild(nCO, -d, n);
+  SetParent(n, nCO);
+  SetChild(nP, nPL == n ? -1 : 1, nCO);
+  SetParent(nCO, nP);
+
+  hRepl = 1 + (hCOO > hO ? hCOO : hO);
+  SetHeight(n, hRepl);
+  hCRepl = 1 + (hCC > hCOC ? hCC : hCOC);
+  SetHeight(nC, hCRepl);
+  SetHeight(nCO, 1 + (hCRepl > hRepl ? hCRepl : hRepl));
+
+  SetVersion(n, v + GENAVL_CONC_SHRINK);
+  SetVersion(nC, vC + GENAVL_CONC_SHRINK);
+
+  GenAVLConcPush(w, nP);
+  GenAVLConcPush(w, nCO);
+  GenAVLConcPush(w, nC);
+  GenAVLConcPush(w, n);
+}
+
+/*******************************************************
+ *
+ * n's child on side d, nC, is too tall against hO, the
+ * height of the other. Rotate it up, first rotating its
+ * inner child up if that is the taller. Returns n if
+ * the heights seen under the locks call for nothing.
+ *
+ *******************************************************/
+static Node* GenAVLConcRebalanceToNl(GenAVLConcWork* w,
+                                     Node* nP,
+                                     Node* n,
+                                     int d,
+                                     Node* nC,
+                                     int hO) {
+  Node* nCO;
+  int hCC;
+  int hCO;
+
+  Lock(nC);
+  if (Height(nC) - hO <= 1) {
+    Unlock(nC);
+    return n;
+  }
+  nCO = Child(nC, -d);
+  hCC = Height(Child(nC, d));
+  if (hCC >= Height(nCO)) {
+    GenAVLConcRotateNl(w, nP, n, d, nC, hO, hCC, nCO, Height(nCO));
+    Unlock(nC);
+    return 0;
+  }
+  Lock(nCO);
+  hCO = Height(nCO);
+  if (hCC >= hCO)
+    GenAVLConcRotateNl(w, nP, n, d, nC, hO, hCC, nCO, hCO);
+  else
+    GenAVLConcRotateOverNl(w, nP, n, d, nC, hO, hCC, nCO);
+  Unlock(nCO);
+  Unlock(nC);
+  return 0;
+}
+
+static Node* GenAVLConcRebalanceNl(GenAVLConc* gacp,
+                                   int slot,
+                                   GenAVLConcWork* w,
+                                   Node* nP,
+                                   Node* n) {
+  Node* nL = Child(n, -1);
+  Node* nR = Child(n, 1);
+  int hN;
+  int hL;
+  int hR;
+  int hRepl;
+
+  if ((!nL || !nR) && !Value(n))
+    return GenAVLConcUnlinkNl(gacp, slot, nP, n) ? GenAVLConcFixHeightNl(nP)
+                                                 : n;
+  hN = Height(n);
+  hL = Height(nL);
+  hR = Height(nR);
+  hRepl = 1 + (hL > hR ? hL : hR);
+  if (hL - hR > 1)
+    return GenAVLConcRebalanceToNl(w, nP, n, -1, nL, hR);
+  if (hL - hR < -1)
+    return GenAVLConcRebalanceToNl(w, nP, n, 1, nR, hL);
+  if (hRepl != hN) {
+    SetHeight(n, hRepl);
+    return GenAVLConcFixHeightNl(nP);
+  }
+  return 0;
+}
+
+/*******************************************************
+ *
+ * Repair from the node up until nothing is left to fix
+ * or another thread has taken it on, then do the same
+ * for each node a rotation left on the stack
+ *
+ *******************************************************/
+static void GenAVLConcRepair(GenAVLConc* gacp, int slot, Node* n) {
+  GenAVLConcWork w;
+  Node* nP;
+  Node* next;
+  int c;
+
+  w.sp = 0;
+  for (;;) {
+    while (n && Parent(n)) {
+      c = GenAVLConcCondition(n);
+      if (c == GENAVL_CONC_NOTHING || (Version(n) & GENAVL_CONC_UNLINKED))
+        break;
+      if (c != GENAVL_CONC_UNLINK && c != GENAVL_CONC_REBALANCE) {
+        Lock(n);
+        next = GenAVLConcFixHeightNl(n);
+        Unlock(n);
+        n = next;
+      } else {
+        nP = Parent(n);
+        Lock(nP);
+        if (!(Version(nP) & GENAVL_CONC_UNLINKED) && Parent(n) == nP) {
+          Lock(n);
+          next = GenAVLConcRebalanceNl(gacp, slot, &w, nP, n);
+          Unlock(n);
+          n = next;
+        }
+        Unlock(nP);
+      }
+    }
+    if (!w.sp)
+      return;
+    n = w.stack[--w.sp];
+  }
+}
+
+/***************************************************************
+ *
+ * Searches
+ *
+ * Each function below is handed a node, the direction from it
+ * the key lies in and the version noted before that direction
+ * was decided. It returns GENAVL_CONC_RETRY if that version has
+ * changed, meaning the node may have been moved so that the key
+ * is no longer below it, and the caller goes round again.
+ *
+ ***************************************************************/
+static void* GenAVLConcGetFrom(GenAVLConc* gacp,
+                               const void* key,
+                               Node* n,
+                               int dir,
+                               unsigned long v) {
+  Node* c;
+  unsigned long vc;
+  void* r;
+  int cdir;
+
+  for (;;) {
+    c = Child(n, dir);
+    if (Version(n) != v)
+      return GENAVL_CONC_RETRY;
+    if (!c)
+      return 0;
+    if (!(cdir = GenAVLConcCompare(gacp, key, c)))
+      return Value(c);
+    vc = Version(c);
+    if (vc & GENAVL_CONC_CHANGING) {
+      GenAVLConcWait(c);
+    } else if (c == Child(n, dir)) {
+      if (Version(n) != v)
+        return GENAVL_CONC_RETRY;
+      if ((r = GenAVLConcGetFrom(gacp, key, c, cdir, vc)) != GENAVL_CONC_RETRY)
+        return r;
+    }
+    if (Version(n) != v)
+      return GENAVL_CONC_RETRY;
+  }
+}
+
+/*******************************************************
+ *
+ * Add the node nn below n, or give the data to the node
+ * with the key if it has been deleted. Returns 1 if
+ * added, 0 if the key is present.
+ *
+ *******************************************************/
+static void* GenAVLConcAddFrom(GenAVLConc* gacp,
+                               int slot,
+                               const void* key,
+                               Node* nn,
+                               Node* n,
+                               int dir,
+                               unsigned long v) {
+  Node* c;
+  Node* damaged;
+  unsigned long vc;
+  void* r;
+  int cdir;
+
+  for (;;) {
+    c = Child(n, dir);
+    if (Version(n) != v)
+      return GENAVL_CONC_RETRY;
+    if (!c) {
+      Lock(n);
+      if (Version(n) != v) {
+        Unlock(n);
+        return GENAVL_CONC_RETRY;
+      }
+      if (Child(n, dir)) {
+        /* Lost a race with another add; look again */
+        Unlock(n);
+        continue;
+      }
+      SetParent(nn, n);
+      SetChild(n, dir, nn);
+      damaged = GenAVLConcFixHeightNl(n);
+      Unlock(n);
+      GenAVLConcRepair(gacp, slot, damaged);
+      return nn;
+    }
+    if (!(cdir = GenAVLConcCompare(gacp, key, c))) {
+      Lock(c);
+      if (Version(c) & GENAVL_CONC_UNLINKED) {
+        Unlock(c);
+        return GENAVL_CONC_RETRY;
+      }
+      r = Value(c) ? 0 : c;
+      if (r)
+        SetValue(c, Value(nn));
+      Unlock(c);
+      return r;
+    }
+    vc = Version(c);
+    if (vc & GENAVL_CONC_CHANGING) {
+      GenAVLConcWait(c);
+    } else if (c == Child(n, dir)) {
+      if (Version(n) != v)
+        return GENAVL_CONC_RETRY;
+      r = GenAVLConcAddFrom(gacp, slot, key, nn, c, cdir, vc);
+      if (r != GENAVL_CONC_RETRY)
+        return r;
+    }
+    if (Version(n) != v)
+      return GENAVL_CONC_RETRY;
+  }
+}
+
+/*******************************************************
+ *
+ * Delete the data of the node n found with the key
+ * below nP. A node with at most one child is spliced
+ * out under the locks of both; one with two is left in
+ * place without its data.
+ *
+ *******************************************************/
+static void* GenAVLConcDeleteAt(GenAVLConc* gacp,
+                                int slot,
+                                Node* nP,
+                                Node* n) {
+  Node* damaged;
+  void* prev;
+
+  if (!Value(n))
+    return 0;
+  if (!Child(n, -1) || !Child(n, 1)) {
+    Lock(nP);
+    if ((Version(nP) & GENAVL_CONC_UNLINKED) || Parent(n) != nP) {
+      Unlock(nP);
+      return GENAVL_CONC_RETRY;
+    }
+    Lock(n);
+    if (!(prev = Value(n))) {
+      Unlock(n);
+      Unlock(nP);
+      return 0;
+    }
+    if (!GenAVLConcUnlinkNl(gacp, slot, nP, n)) {
+      Unlock(n);
+      Unlock(nP);
+      return GENAVL_CONC_RETRY;
+    }
+    Unlock(n);
+    damaged = GenAVLConcFixHeightNl(nP);
+    Unlock(nP);
+    GenAVLConcRepair(gacp, slot, damaged);
+  } else {
+    Lock(n);
+    if (Version(n) & GENAVL_CONC_UNLINKED) {
+      Unlock(n);
+      return GENAVL_CONC_RETRY;
+    }
+    if (!(prev = Value(n))) {
+      Unlock(n);
+      return 0;
+    }
+    if (!Child(n, -1) || !Child(n, 1)) {
+      Unlock(n);
+      return GENAVL_CONC_RETRY;
+    }
+    SetValue(n, 0);
+    Unlock(n);
+  }
+
+  /* Data that is not also the node's key can go now */
+  if (prev != (void*)n->entry.data)
+    GenAVLConcRetireData(gacp, slot, prev);
+  return prev;
+}
+
+static void* GenAVLConcDeleteFrom(GenAVLConc* gacp,
+                                  int slot,
+                                  const void* key,
+                                  Node* n,
+                                  int dir,
+                                  unsigned long v) {
+  Node* c;
+  unsigned long vc;
+  void* r;
+  int cdir;
+
+  for (;;) {
+    c = Child(n, dir);
+    if (Version(n) != v)
+      return GENAVL_CONC_RETRY;
+    if (!c)
+      return 0;
+    if (!(cdir = GenAVLConcCompare(gacp, key, c))) {
+      if ((r = GenAVLConcDeleteAt(gacp, slot, n, c)) != GENAVL_CONC_RETRY)
+        return r;
+    } else {
+      vc = Version(c);
+      if (vc & GENAVL_CONC_CHANGING) {
+        GenAVLConcWait(c);
+      } else if (c == Child(n, dir)) {
+        if (Version(n) != v)
+          return GENAVL_CONC_RETRY;
+        r = GenAVLConcDeleteFrom(gacp, slot, key, c, cdir, vc);
+        if (r != GENAVL_CONC_RETRY)
+          return r;
+      }
+    }
+    if (Version(n) != v)
+      return GENAVL_CONC_RETRY;
+  }
+}
+
+/*******************************************************
+ *
+ * Find the data with the key, or return 0
+ *
+ *******************************************************/
+void* GenAVLConcFind(GenAVLConc* gacp, int slot, const void* key) {
+  void* r;
+
+  GenAVLConcReadLock(gacp, slot);
+  do
+    r = GenAVLConcGetFrom(gacp, key, &gacp->holder, 1, 0);
+  while (r == GENAVL_CONC_RETRY);
+  GenAVLConcReadUnlock(gacp, slot);
+  return r;
+}
+
+/*******************************************************
+ *
+ * Add the data to the tree. If there exists data with
+ * the same key already, return 0. Otherwise return 1,
+ * or -1 if no node could be allocated.
+ *
+ *******************************************************/
+int GenAVLConcAdd(GenAVLConc* gacp, int slot, void* data) {
+  Node* nn = (Node*)malloc(sizeof(Node));
+  const void* key;
+  void* r;
+
+  if (!nn)
+    return -1;
+  memset((void*)nn, 0, sizeof(Node));
+  nn->entry.data = data;
+  nn->value = data;
+  nn->height = 1;
+  key = gacp->tree.Key(&nn->entry);
+
+  GenAVLConcReadLock(gacp, slot);
+  do
+    r = GenAVLConcAddFrom(gacp, slot, key, nn, &gacp->holder, 1, 0);
+  while (r == GENAVL_CONC_RETRY);
+  GenAVLConcReadUnlock(gacp, slot);
+  if (r != nn)
+    free(nn);
+  return r != 0;
+}
+
+/*******************************************************
+ *
+ * Delete the data with the key and return it, or 0 if
+ * there is none. It must not be freed or reused until
+ * Free is called for it.
+ *
+ *******************************************************/
+void* GenAVLConcDelete(GenAVLConc* gacp, int slot, const void* key) {
+  void* r;
+
+  GenAVLConcReadLock(gacp, slot);
+  do
+    r = GenAVLConcDeleteFrom(gacp, slot, key, &gacp->holder, 1, 0);
+  while (r == GENAVL_CONC_RETRY);
+  GenAVLConcReadUnlock(gacp, slot);
+  return r;
+}
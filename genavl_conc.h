@@ -0,0 +1,133 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GENAVL_CONC_H
+#define GENAVL_CONC_H
+
+#include "genavl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************************************************
+ *
+ * Concurrent trees
+ *
+ * A GenAVLConc is a tree that any number of threads may add to,
+ * delete from and search at once, with no lock on the tree as a
+ * whole. It follows Bronson, Casper, Chafi and Olukotun, "A
+ * Practical Concurrent Binary Search Tree" (PPoPP 2010): each
+ * node has its own lock and a version, which a rotation that
+ * moves the node down changes. Searches take no lock; they note
+ * the version of each node as they pass it and go back a step
+ * if it has changed before they are done with the node. Adds and
+ * deletes search the same way, then lock only the node or two
+ * they change, and the rotations that follow lock only the
+ * three or four nodes they move, so threads working in
+ * different parts of the tree, or even near one another, rarely
+ * wait. Balance is relaxed while changes are in flight and
+ * restored as each finishes.
+ *
+ * The nodes are allocated by the tree rather than embedded in
+ * the data, as each carries more than a GenAVLEntry; the data
+ * pointer of the GenAVLEntry within each is what the Compare and
+ * Key methods of the GenAVLTree given to GenAVLConcInit are
+ * called with. Deleting an entry with two children leaves its
+ * node in place, keyed by the data deleted, until it has fewer,
+ * so the key of deleted data must stay readable until Free is
+ * called for it. Free is called for data deleted once no thread
+ * can still be reading it, and not for data still in the tree
+ * at GenAVLConcDestroy.
+ *
+ * Nodes and data are freed on the same epoch scheme as
+ * GenAVLRcu, but every thread may free as well as read, so each
+ * thread using the tree takes a slot with GenAVLConcRegister and
+ * passes it to every call. The data returned by GenAVLConcFind
+ * may be deleted and freed at any moment; to keep it readable,
+ * bracket the find and its use with GenAVLConcReadLock and
+ * GenAVLConcReadUnlock:
+ *
+ * long lookup(GenAVLConc *gacp, int slot, long k) {
+ *   MyData *data;
+ *   long v;
+ *
+ *   GenAVLConcReadLock(gacp, slot);
+ *   data = (MyData *)GenAVLConcFind(gacp, slot, &k);
+ *   v = data ? data->value : -1;
+ *   GenAVLConcReadUnlock(gacp, slot);
+ *   return v;
+ * }
+ *
+ * A thread that stays within a read lock holds up all freeing.
+ *
+ ***************************************************************/
+#define GENAVL_CONC_THREADS 64
+
+typedef struct GENAVLCONCNODE {
+  GenAVLEntry entry;
+  void* value;
+  unsigned long version;
+  int height;
+  int lock;
+  struct GENAVLCONCNODE* parent;
+  struct GENAVLCONCNODE* left;
+  struct GENAVLCONCNODE* right;
+  struct GENAVLCONCNODE* next;
+} GenAVLConcNode;
+
+typedef struct {
+  unsigned long epoch;
+  int used;
+  int depth;
+  unsigned long tag[3];
+  GenAVLConcNode* nodes[3];
+  void** data[3];
+  size_t ndata[3];
+  size_t maxdata[3];
+  size_t nretired;
+  void* pending;
+  unsigned long pendingtag;
+  char pad[64];
+} GenAVLConcSlot;
+
+typedef struct {
+  GenAVLTree tree;
+  void (*Free)(void*);
+  GenAVLConcNode holder;
+  unsigned long epoch;
+  GenAVLConcSlot slots[GENAVL_CONC_THREADS];
+} GenAVLConc;
+
+void GenAVLConcInit(GenAVLConc*, GenAVLTree*, void (*)(void*));
+void GenAVLConcDestroy(GenAVLConc*);
+int GenAVLConcRegister(GenAVLConc*);
+void GenAVLConcUnregister(GenAVLConc*, int);
+void GenAVLConcReadLock(GenAVLConc*, int);
+void GenAVLConcReadUnlock(GenAVLConc*, int);
+int GenAVLConcAdd(GenAVLConc*, int, void*);
+void* GenAVLConcDelete(GenAVLConc*, int, const void*);
+void* GenAVLConcFind(GenAVLConc*, int, const void*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GENAVL_CONC_H */
@@ -0,0 +1,180 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GENAVL_LOG_H
+#define GENAVL_LOG_H
+
+#include "genavl.h"
+
+/***************************************************************
+ *
+ * Undo logs
+ *
+ * A GenAVLLog lets a change to a tree kept in shared or mapped
+ * memory be undone if the process making it dies part way. It
+ * lives in the same region as the tree. Before a word of an
+ * entry or the root is changed, its offset from the start of
+ * the region and its old contents are saved in the log, and
+ * when the change is done the log is emptied. A log found not
+ * to be empty is undone by writing the saved words back,
+ * latest first, which leaves the tree as it was before.
+ *
+ * GENAVL_LOG_SIZE records are enough for any one add or delete
+ * on a tree no deeper than MAX_GENAVL_STACK.
+ *
+ ***************************************************************/
+#define GENAVL_LOG_SIZE (32 * MAX_GENAVL_STACK)
+
+typedef struct {
+  size_t offset;
+  unsigned long long word;
+} GenAVLLogRecord;
+
+typedef struct {
+  volatile unsigned int n;
+  GenAVLLogRecord rec[GENAVL_LOG_SIZE];
+} GenAVLLog;
+
+#ifdef __cplusplus
+
+#include <atomic>
+#include <cstdint>
+
+#include "genavl_tree.h"
+
+namespace genavl {
+namespace detail {
+
+/***************************************************************
+ *
+ * Policy which logs every change made through the Base policy:
+ * before a link, balance or count is set, the 8-byte word
+ * holding it is saved, and the number of records is raised only
+ * once the record is written. The fences keep the compiler from
+ * moving a change ahead of its record; a process that is
+ * killed has all of its stores reach the memory in program
+ * order. The root may be kept anywhere, so its address is
+ * given. What Augment keeps in the data is not logged.
+ *
+ ***************************************************************/
+template <class Base>
+struct log_policy : Base {
+  typedef typename Base::node_ptr node_ptr;
+
+  GenAVLLog* log;
+  char* base;
+  const void* root_slot;
+
+  log_policy(const Base& b, GenAVLLog* l, void* region, const void* slot)
+      : Base(b), log(l), base((char*)region), root_slot(slot) {}
+
+  void save(const void* a) {
+    uintptr_t w = (uintptr_t)a & ~(uintptr_t)7;
+    GenAVLLogRecord* r;
+
+    if (log->n == GENAVL_LOG_SIZE)
+      return;
+    r = &log->rec[log->n];
+    r->offset = w - (uintptr_t)base;
+    r->word = *(unsigned long long*)w;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    log->n = log->n + 1;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+  }
+  void commit() {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    log->n = 0;
+  }
+
+  void set_root(node_ptr n) {
+    save(root_slot);
+#if defined(USE_GENAVL_PARENT)
+    if (n)
+      save(&n->parent);
+#endif
+    Base::set_root(n);
+  }
+  void set_left(node_ptr n, node_ptr c) {
+    save(&n->left);
+#if defined(USE_GENAVL_PARENT)
+    if (c)
+      save(&c->parent);
+#endif
+    Base::set_left(n, c);
+  }
+  void set_right(node_ptr n, node_ptr c) {
+    save(&n->right);
+#if defined(USE_GENAVL_PARENT)
+    if (c)
+      save(&c->parent);
+#endif
+    Base::set_right(n, c);
+  }
+  void set_balance(node_ptr n, int b) {
+    save(&n->balance);
+    Base::set_balance(n, b);
+  }
+  void fix(node_ptr n) {
+#if defined(USE_GENAVL_COUNT)
+    save(&n->count);
+#endif
+    Base::fix(n);
+  }
+#if defined(USE_GENAVL_COUNT)
+  void grow(node_ptr n) {
+    save(&n->count);
+    Base::grow(n);
+  }
+#endif
+};
+
+/***************************************************************
+ *
+ * Undo whatever the log holds for the region of size bytes at
+ * base, then empty it. Being interrupted here does no harm, as
+ * the words are all written again on the next attempt. Returns
+ * 1 if there was anything to undo, 0 if not and -1 if the log
+ * is not valid for the region.
+ *
+ ***************************************************************/
+inline int undo_log(GenAVLLog* log, void* base, size_t size) {
+  GenAVLLogRecord* r;
+  unsigned int n = log->n;
+
+  if (n > GENAVL_LOG_SIZE)
+    return -1;
+  while (n) {
+    r = &log->rec[--n];
+    if (r->offset > size - sizeof(r->word))
+      return -1;
+    *(unsigned long long*)((char*)base + r->offset) = r->word;
+  }
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  n = log->n;
+  log->n = 0;
+  return n != 0;
+}
+
+}  // namespace detail
+}  // namespace genavl
+
+#endif /* __cplusplus */
+
+#endif /* GENAVL_LOG_H */
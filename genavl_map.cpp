@@ -0,0 +1,255 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "genavl_map.h"
+
+#define GENAVL_MAP_MAGIC 0x4d6c7641
+#define GENAVL_MAP_VERSION 2
+
+typedef genavl::detail::log_policy<genavl::detail::c_policy> log_policy;
+
+/*******************************************************
+ *
+ * Return the offset of the arena in the file, the size
+ * of the header rounded up to the arena alignment
+ *
+ *******************************************************/
+static size_t GenAVLMapArenaOffset() {
+  return (sizeof(GenAVLMapHeader) + GENAVL_ARENA_ALIGN - 1) &
+         ~(size_t)(GENAVL_ARENA_ALIGN - 1);
+}
+
+/*******************************************************
+ *
+ * Map size bytes of the open file, or return 0
+ *
+ *******************************************************/
+static void* GenAVLMapMap(int fd, size_t size) {
+  void* base = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  return base == MAP_FAILED ? 0 : base;
+}
+
+/*******************************************************
+ *
+ * Map the file at path, setting up an empty tree and
+ * arena in it if it is new. A file already holding a
+ * tree is checked before it is lengthened to size bytes
+ * if it is shorter. The file is locked for as long as
+ * it is open. Returns 0 if the file cannot be opened,
+ * locked or mapped, or holds something else.
+ *
+ *******************************************************/
+GenAVLMap* GenAVLMapOpen(const char* path, size_t size) {
+  GenAVLMapHeader* gamhp;
+  GenAVLMap* gamp;
+  struct stat st;
+  size_t off = GenAVLMapArenaOffset();
+  size_t len;
+  int fd;
+
+  if ((fd = open(path, O_RDWR | O_CREAT, 0666)) < 0)
+    return 0;
+  if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+    close(fd);
+    return 0;
+  }
+  if (size < off + GENAVL_ARENA_CHUNK)
+    size = off + GENAVL_ARENA_CHUNK;
+  len = 0;
+  if (fstat(fd, &st) == 0)
+    len = st.st_size ? (size_t)st.st_size : size;
+  if (len < off + sizeof(GenAVLArena) ||
+      (st.st_size == 0 && ftruncate(fd, len) < 0) ||
+      !(gamp = (GenAVLMap*)malloc(sizeof(GenAVLMap)))) {
+    close(fd);
+    return 0;
+  }
+  if (!(gamp->base = GenAVLMapMap(fd, len))) {
+    free(gamp);
+    close(fd);
+    return 0;
+  }
+  gamp->size = len;
+  gamp->fd = fd;
+  gamp->recovered = 0;
+
+  gamhp = (GenAVLMapHeader*)gamp->base;
+  if (st.st_size == 0) {
+    GenAVLTreeInit(&gamhp->tree, 0, 0);
+    GenAVLArenaInit((char*)gamp->base + off, len - off);
+    gamhp->version = GENAVL_MAP_VERSION;
+    gamhp->magic = GENAVL_MAP_MAGIC;
+    gamhp->log.n = 0;
+  } else if (gamhp->magic != GENAVL_MAP_MAGIC ||
+             gamhp->version != GENAVL_MAP_VERSION ||
+             !GenAVLArenaAttach((char*)gamp->base + off) ||
+             (gamp->recovered = genavl::detail::undo_log(
+                  &gamhp->log, gamp->base, gamp->size)) < 0 ||
+             !GenAVLMapGrow(gamp, size)) {
+    GenAVLMapClose(gamp);
+    return 0;
+  }
+
+  /* The file is locked by this process alone, so the arena
+   * lock can only be held by one that died holding it */
+  GenAVLMapArena(gamp)->lock = 0;
+  gamhp = (GenAVLMapHeader*)gamp->base;
+  gamhp->tree.Compare = 0;
+  gamhp->tree.Key = 0;
+  gamhp->tree.KeyIncrement = 0;
+  gamhp->tree.KeyCompare = 0;
+#if defined(USE_GENAVL_AUGMENT)
+  gamhp->tree.Augment = 0;
+#endif
+#if defined(USE_GENAVL_PREFIX)
+  gamhp->tree.Prefix = 0;
+#endif
+  return gamp;
+}
+
+/*******************************************************
+ *
+ * Unmap, unlock and close the file
+ *
+ *******************************************************/
+void GenAVLMapClose(GenAVLMap* gamp) {
+  munmap(gamp->base, gamp->size);
+  flock(gamp->fd, LOCK_UN);
+  close(gamp->fd);
+  free(gamp);
+}
+
+/*******************************************************
+ *
+ * Lengthen the file to size bytes and map it again,
+ * mapping the new length before dropping the old so
+ * the tree stays mapped if it fails. Returns 1, or 0
+ * if the file could not be grown.
+ *
+ *******************************************************/
+int GenAVLMapGrow(GenAVLMap* gamp, size_t size) {
+  void* base;
+
+  if (size <= gamp->size)
+    return 1;
+  if (ftruncate(gamp->fd, size) < 0 || !(base = GenAVLMapMap(gamp->fd, size)))
+    return 0;
+  munmap(gamp->base, gamp->size);
+  gamp->base = base;
+  gamp->size = size;
+  GenAVLArenaGrow(GenAVLMapArena(gamp), size - GenAVLMapArenaOffset());
+  return 1;
+}
+
+/*******************************************************
+ *
+ * Write the mapping back to the file. Returns 1, or 0
+ * on failure.
+ *
+ *******************************************************/
+int GenAVLMapSync(GenAVLMap* gamp) {
+  return msync(gamp->base, gamp->size, MS_SYNC) == 0;
+}
+
+/*******************************************************
+ *
+ * Return the tree kept in the mapping
+ *
+ *******************************************************/
+GenAVLTree* GenAVLMapTree(GenAVLMap* gamp) {
+  return &((GenAVLMapHeader*)gamp->base)->tree;
+}
+
+/*******************************************************
+ *
+ * Return the arena kept in the mapping
+ *
+ *******************************************************/
+GenAVLArena* GenAVLMapArena(GenAVLMap* gamp) {
+  return (GenAVLArena*)((char*)gamp->base + GenAVLMapArenaOffset());
+}
+
+/*******************************************************
+ *
+ * Allocate n bytes from the arena, doubling the file
+ * until they fit
+ *
+ *******************************************************/
+void* GenAVLMapAlloc(GenAVLMap* gamp, size_t n) {
+  void* p;
+
+  if (n > GENAVL_ARENA_MAX)
+    return 0;
+  while (!(p = GenAVLArenaAlloc(GenAVLMapArena(gamp), n)))
+    if (!GenAVLMapGrow(gamp, 2 * gamp->size))
+      return 0;
+  return p;
+}
+
+/*******************************************************
+ *
+ * Return a block of n bytes to the arena
+ *
+ *******************************************************/
+void GenAVLMapFree(GenAVLMap* gamp, void* p, size_t n) {
+  GenAVLArenaFree(GenAVLMapArena(gamp), p, n);
+}
+
+/*******************************************************
+ *
+ * Add the entry to the mapped tree as GenAVLTreeAdd
+ * does, logging each change so that it can be undone
+ * if the process dies before the add is finished
+ *
+ *******************************************************/
+int GenAVLMapTreeAdd(GenAVLMap* gamp, GenAVLEntry* gae) {
+  GenAVLMapHeader* gamhp = (GenAVLMapHeader*)gamp->base;
+  log_policy p(genavl::detail::c_policy(&gamhp->tree), &gamhp->log,
+               gamp->base, &gamhp->tree.root);
+  int r = genavl::detail::add(p, gae);
+
+  p.commit();
+  return r;
+}
+
+/*******************************************************
+ *
+ * Delete the entry with the key from the mapped tree as
+ * GenAVLTreeDelete does, logging each change so that
+ * it can be undone if the process dies before the
+ * delete is finished
+ *
+ *******************************************************/
+void* GenAVLMapTreeDelete(GenAVLMap* gamp, const void* key) {
+  GenAVLMapHeader* gamhp = (GenAVLMapHeader*)gamp->base;
+  log_policy p(genavl::detail::c_policy(&gamhp->tree), &gamhp->log,
+               gamp->base, &gamhp->tree.root);
+  GenAVLEntry* gaep = genavl::detail::erase(p, p.make_key(key));
+
+  p.commit();
+  return gaep ? (void*)gaep->data : 0;
+}
@@ -0,0 +1,127 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GENAVL_MAP_H
+#define GENAVL_MAP_H
+
+#include "genavl_arena.h"
+#include "genavl_log.h"
+
+#if !defined(USE_OFFSET_PTR)
+#error "genavl_map.h needs USE_OFFSET_PTR: a mapping may move"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************************************************
+ *
+ * Mapped trees
+ *
+ * A GenAVLMap keeps a GenAVLTree and a GenAVLArena in a file
+ * mapped into memory, so the tree survives the process and is
+ * back the moment the file is mapped again, its pages read in
+ * as they are touched. All links within it are offset_ptr, so
+ * the file may be mapped at any address.
+ *
+ * GenAVLMapOpen maps the file at path, creating it or making
+ * it at least size bytes long if need be. A new file is set up
+ * with an empty tree and an arena covering the rest of it; an
+ * existing one must have been made by GenAVLMapOpen, or 0 is
+ * returned. A file may be open in only one process at a time:
+ * GenAVLMapOpen takes an exclusive flock on it, held until
+ * GenAVLMapClose, and returns 0 if another has it open.
+ * The tree's methods are function pointers, which do not
+ * outlive a process, so they are cleared on every open and must
+ * be set again before the tree is used:
+ *
+ * GenAVLMap *open_index(const char *path) {
+ *   GenAVLMap *gamp = GenAVLMapOpen(path, 1 << 20);
+ *   GenAVLTree *tree;
+ *
+ *   if (gamp) {
+ *     tree = GenAVLMapTree(gamp);
+ *     tree->Compare = MyCompare;
+ *     tree->Key = MyKey;
+ *   }
+ *   return gamp;
+ * }
+ *
+ * GenAVLMapGrow lengthens the file to size bytes and maps it
+ * again, which may move it: every pointer into the old mapping,
+ * including those returned by GenAVLMapTree and GenAVLMapArena,
+ * must be fetched again, and nothing else may be using the
+ * mapping meanwhile. GenAVLMapAlloc allocates from the arena,
+ * growing the file to twice its size when the arena is full,
+ * with the same consequences. GenAVLMapFree returns a block to
+ * the arena.
+ *
+ * GenAVLMapSync writes the mapping back to the file and waits
+ * for it. GenAVLMapClose unmaps and closes the file; changes
+ * reach the file even without a sync, unless the system fails.
+ *
+ * A process killed in the middle of GenAVLTreeAdd or
+ * GenAVLTreeDelete can leave a rotation half done in the file.
+ * GenAVLMapTreeAdd and GenAVLMapTreeDelete do the same work but
+ * first save each word of the tree they are about to change in
+ * a GenAVLLog kept in the file, and empty the log when they
+ * are done. If the process dies in between, the next
+ * GenAVLMapOpen writes the saved words back, which leaves the
+ * tree as it was before the interrupted call, and sets
+ * recovered in the GenAVLMap. The log covers the links,
+ * balances and counts of the entries and the root, but not
+ * what Augment keeps in the data, so a tree with an Augment
+ * should be given GenAVLTreeReaugment after a recovery. An
+ * entry allocated for an add that was undone stays allocated.
+ * This guards against the process dying, not the system: the
+ * file is only as current as the last GenAVLMapSync then.
+ *
+ ***************************************************************/
+typedef struct {
+  unsigned int magic;
+  unsigned int version;
+  GenAVLTree tree;
+  GenAVLLog log;
+} GenAVLMapHeader;
+
+typedef struct {
+  void* base;
+  size_t size;
+  int fd;
+  int recovered;
+} GenAVLMap;
+
+GenAVLMap* GenAVLMapOpen(const char*, size_t);
+void GenAVLMapClose(GenAVLMap*);
+int GenAVLMapGrow(GenAVLMap*, size_t);
+int GenAVLMapSync(GenAVLMap*);
+GenAVLTree* GenAVLMapTree(GenAVLMap*);
+GenAVLArena* GenAVLMapArena(GenAVLMap*);
+void* GenAVLMapAlloc(GenAVLMap*, size_t);
+void GenAVLMapFree(GenAVLMap*, void*, size_t);
+int GenAVLMapTreeAdd(GenAVLMap*, GenAVLEntry*);
+void* GenAVLMapTreeDelete(GenAVLMap*, const void*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GENAVL_MAP_H */
@@ -0,0 +1,359 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+
+#include "genavl_persist.h"
+#include "genavl_tree.h"
+
+using genavl::detail::c_policy;
+
+namespace {
+
+/***************************************************************
+ *
+ * Policy for the writer, which copies on reading: the root and
+ * every child it is handed belong to the version being made,
+ * copied from the version before if need be and linked in place
+ * of the original, which is retired. As the algorithms reach
+ * every entry they change through these, nothing shared with an
+ * older version is ever changed. Copies come from the spares
+ * put by beforehand, so running out cannot leave a version half
+ * made.
+ *
+ ***************************************************************/
+struct cow_policy : c_policy {
+  GenAVLPersist* gapp;
+  GenAVLPersistVersion* v;
+  GenAVLEntry* work;
+  int owned;
+
+  cow_policy(GenAVLPersist* g, GenAVLPersistVersion* nv)
+      : c_policy(&g->tree), gapp(g), v(nv), work(g->tree.root), owned(0) {}
+
+  static GenAVLPersistNode* node(node_ptr n) { return (GenAVLPersistNode*)n; }
+
+  node_ptr own(node_ptr n) {
+    GenAVLPersistNode* gapnp;
+
+    if (!n || node(n)->version == v->version)
+      return n;
+    gapnp = gapp->spare;
+    gapp->spare = gapnp->next;
+    gapp->nspare--;
+    gapnp->entry = *n;
+    gapnp->version = v->version;
+    node(n)->next = v->retired;
+    v->retired = node(n);
+    return &gapnp->entry;
+  }
+
+  node_ptr root() {
+    if (!owned) {
+      work = own(work);
+      owned = 1;
+    }
+    return work;
+  }
+  void set_root(node_ptr n) {
+    work = n;
+    owned = 1;
+  }
+  node_ptr left(node_ptr n) {
+    GenAVLEntry* c = n->left;
+
+    if (c && node(c)->version != v->version)
+      n->left = c = own(c);
+    return c;
+  }
+  node_ptr right(node_ptr n) {
+    GenAVLEntry* c = n->right;
+
+    if (c && node(c)->version != v->version)
+      n->right = c = own(c);
+    return c;
+  }
+};
+
+}  // namespace
+
+/*******************************************************
+ *
+ * Free the entries on a retired list
+ *
+ *******************************************************/
+static void GenAVLPersistFreeList(GenAVLPersistNode* gapnp) {
+  GenAVLPersistNode* next;
+
+  for (; gapnp; gapnp = next) {
+    next = gapnp->next;
+    free(gapnp);
+  }
+}
+
+/*******************************************************
+ *
+ * Drop the oldest versions while nobody holds them. An
+ * entry retired by a version is reachable only from
+ * those before it, so once the oldest version goes its
+ * successor's retired entries can go too. The lock must
+ * be held.
+ *
+ *******************************************************/
+static void GenAVLPersistReclaim(GenAVLPersist* gapp) {
+  GenAVLPersistVersion* gapvp;
+
+  while ((gapvp = gapp->oldest) != gapp->current && gapvp->refs == 0) {
+    gapp->oldest = gapvp->next;
+    GenAVLPersistFreeList(gapp->oldest->retired);
+    gapp->oldest->retired = 0;
+    free(gapvp);
+  }
+}
+
+/*******************************************************
+ *
+ * Make sure there are spares enough for any add or
+ * delete: one for each entry on the longest path, and
+ * two more per level for the entries rotations reach.
+ * Returns 0 if memory ran out.
+ *
+ *******************************************************/
+static int GenAVLPersistReserve(GenAVLPersist* gapp) {
+  GenAVLPersistNode* gapnp;
+  GenAVLEntry* gaep;
+  size_t need = 4;
+
+  for (gaep = gapp->tree.root; gaep;
+       gaep = gaep->balance > 0 ? gaep->right : gaep->left)
+    need += 3;
+  while (gapp->nspare < need) {
+    if (!(gapnp = (GenAVLPersistNode*)malloc(sizeof(GenAVLPersistNode))))
+      return 0;
+    gapnp->next = gapp->spare;
+    gapp->spare = gapnp;
+    gapp->nspare++;
+  }
+  return 1;
+}
+
+/*******************************************************
+ *
+ * Set up an empty tree with its first version. Returns
+ * 1, or 0 if memory ran out.
+ *
+ *******************************************************/
+int GenAVLPersistInit(GenAVLPersist* gapp) {
+  GenAVLPersistVersion* gapvp;
+
+  if (!(gapvp = (GenAVLPersistVersion*)malloc(sizeof(GenAVLPersistVersion))))
+    return 0;
+  gapvp->root = 0;
+  gapvp->version = 0;
+  gapvp->refs = 0;
+  gapvp->retired = 0;
+  gapvp->next = 0;
+  GenAVLTreeInit(&gapp->tree, 0, 0);
+  pthread_mutex_init(&gapp->lock, 0);
+  gapp->oldest = gapvp;
+  gapp->current = gapvp;
+  gapp->spare = 0;
+  gapp->nspare = 0;
+  return 1;
+}
+
+/*******************************************************
+ *
+ * Free the entries of a subtree
+ *
+ *******************************************************/
+static void GenAVLPersistFreeTree(GenAVLEntry* gaep) {
+  GenAVLEntry* right;
+
+  while (gaep) {
+    GenAVLPersistFreeTree(gaep->left);
+    right = gaep->right;
+    free(gaep);
+    gaep = right;
+  }
+}
+
+/*******************************************************
+ *
+ * Free every version, entry and spare
+ *
+ *******************************************************/
+void GenAVLPersistDestroy(GenAVLPersist* gapp) {
+  GenAVLPersistVersion* gapvp;
+
+  GenAVLPersistFreeTree(gapp->tree.root);
+  while ((gapvp = gapp->oldest)) {
+    gapp->oldest = gapvp->next;
+    GenAVLPersistFreeList(gapvp->retired);
+    free(gapvp);
+  }
+  GenAVLPersistFreeList(gapp->spare);
+  gapp->current = 0;
+  gapp->spare = 0;
+  gapp->nspare = 0;
+  gapp->tree.root = 0;
+  pthread_mutex_destroy(&gapp->lock);
+}
+
+/*******************************************************
+ *
+ * Start the next version, with spares for it. Returns 0
+ * if memory ran out.
+ *
+ *******************************************************/
+static GenAVLPersistVersion* GenAVLPersistBegin(GenAVLPersist* gapp) {
+  GenAVLPersistVersion* gapvp;
+
+  if (!GenAVLPersistReserve(gapp) ||
+      !(gapvp = (GenAVLPersistVersion*)malloc(sizeof(GenAVLPersistVersion))))
+    return 0;
+  gapvp->root = 0;
+  gapvp->version = gapp->current->version + 1;
+  gapvp->refs = 0;
+  gapvp->retired = 0;
+  gapvp->next = 0;
+  return gapvp;
+}
+
+/*******************************************************
+ *
+ * Make the version just built the newest
+ *
+ *******************************************************/
+static void GenAVLPersistPublish(GenAVLPersist* gapp, cow_policy& p) {
+  p.v->root = p.work;
+  pthread_mutex_lock(&gapp->lock);
+  gapp->current->next = p.v;
+  gapp->current = p.v;
+  gapp->tree.root = p.work;
+  GenAVLPersistReclaim(gapp);
+  pthread_mutex_unlock(&gapp->lock);
+}
+
+/*******************************************************
+ *
+ * Add an entry for the data in a new version. Returns
+ * 1, 0 if the key is already in the tree, or -1 if
+ * memory ran out.
+ *
+ *******************************************************/
+int GenAVLPersistAdd(GenAVLPersist* gapp, void* data) {
+  GenAVLPersistVersion* gapvp;
+  GenAVLPersistNode* gapnp;
+  c_policy q(&gapp->tree);
+  GenAVLEntry e;
+
+  e.data = data;
+  if (genavl::detail::find(q, q.key(&e)))
+    return 0;
+  if (!(gapnp = (GenAVLPersistNode*)malloc(sizeof(GenAVLPersistNode))))
+    return -1;
+  if (!(gapvp = GenAVLPersistBegin(gapp))) {
+    free(gapnp);
+    return -1;
+  }
+
+  cow_policy p(gapp, gapvp);
+  GenAVLInit(&gapnp->entry, data);
+  gapnp->version = gapvp->version;
+  genavl::detail::add(p, &gapnp->entry);
+  GenAVLPersistPublish(gapp, p);
+  return 1;
+}
+
+/*******************************************************
+ *
+ * Delete the entry with the key in a new version and
+ * return its data, or 0 if there is none or memory ran
+ * out. The copy of the entry made on the way down is
+ * in no version and goes at once.
+ *
+ *******************************************************/
+void* GenAVLPersistDelete(GenAVLPersist* gapp, const void* key) {
+  GenAVLPersistVersion* gapvp;
+  c_policy q(&gapp->tree);
+  GenAVLEntry* gaep;
+  void* data;
+
+  if (!genavl::detail::find(q, q.make_key(key)) ||
+      !(gapvp = GenAVLPersistBegin(gapp)))
+    return 0;
+
+  cow_policy p(gapp, gapvp);
+  gaep = genavl::detail::erase(p, p.make_key(key));
+  data = gaep->data;
+  free(gaep);
+  GenAVLPersistPublish(gapp, p);
+  return data;
+}
+
+/*******************************************************
+ *
+ * Take hold of the newest version
+ *
+ *******************************************************/
+GenAVLPersistVersion* GenAVLPersistAcquire(GenAVLPersist* gapp) {
+  GenAVLPersistVersion* gapvp;
+
+  pthread_mutex_lock(&gapp->lock);
+  gapvp = gapp->current;
+  gapvp->refs++;
+  pthread_mutex_unlock(&gapp->lock);
+  return gapvp;
+}
+
+/*******************************************************
+ *
+ * Let go of a version, freeing what only it needed
+ *
+ *******************************************************/
+void GenAVLPersistRelease(GenAVLPersist* gapp, GenAVLPersistVersion* gapvp) {
+  pthread_mutex_lock(&gapp->lock);
+  gapvp->refs--;
+  GenAVLPersistReclaim(gapp);
+  pthread_mutex_unlock(&gapp->lock);
+}
+
+/*******************************************************
+ *
+ * Fill in a tree with the methods of the persistent
+ * tree and the root of the version. The writer may be
+ * changing tree.root meanwhile, so it is not copied.
+ *
+ *******************************************************/
+void GenAVLPersistView(GenAVLPersist* gapp,
+                       GenAVLPersistVersion* gapvp,
+                       GenAVLTree* gatp) {
+  gatp->root = gapvp->root;
+  gatp->Compare = gapp->tree.Compare;
+  gatp->Key = gapp->tree.Key;
+  gatp->KeyIncrement = gapp->tree.KeyIncrement;
+  gatp->KeyCompare = gapp->tree.KeyCompare;
+#if defined(USE_GENAVL_AUGMENT)
+  gatp->Augment = 0;
+#endif
+#if defined(USE_GENAVL_PREFIX)
+  gatp->Prefix = gapp->tree.Prefix;
+#endif
+}
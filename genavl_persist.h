@@ -0,0 +1,123 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GENAVL_PERSIST_H
+#define GENAVL_PERSIST_H
+
+#include <pthread.h>
+
+#include "genavl.h"
+
+#if defined(USE_GENAVL_PARENT)
+#error "genavl_persist.h cannot be used with USE_GENAVL_PARENT"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************************************************
+ *
+ * Persistent trees
+ *
+ * A GenAVLPersist is a tree whose past versions stay readable.
+ * Each GenAVLPersistAdd or GenAVLPersistDelete makes a new
+ * version by copying the entries it would change, those on the
+ * path from the root and those moved by the rotations, and
+ * shares all the rest with the version before. Readers take a
+ * version with GenAVLPersistAcquire and see the tree exactly as
+ * it was then for as long as they hold it, whatever the writer
+ * does meanwhile, without locking anything while they read.
+ *
+ * The entries belong to the GenAVLPersist, which allocates them
+ * with malloc; the caller supplies only the data for each. Set
+ * the methods of tree, as for any GenAVLTree, before adding;
+ * Augment must be 0, as the data is shared by all versions.
+ * tree.root is always the newest version.
+ *
+ * GenAVLPersistView fills in a GenAVLTree for a version, which
+ * may be given to GenAVLTreeFind, the iterators and any other
+ * call which does not change the tree:
+ *
+ * long total(GenAVLPersist *gapp) {
+ *   GenAVLPersistVersion *v = GenAVLPersistAcquire(gapp);
+ *   GenAVLTree view;
+ *   GenAVLDFIter it;
+ *   MyData *data;
+ *   long sum = 0;
+ *
+ *   GenAVLPersistView(gapp, v, &view);
+ *   for (data = GenAVLDFIterInitData(&it, &view); data;
+ *        data = GenAVLDFIterNextData(&it))
+ *     sum += data->value;
+ *   GenAVLPersistRelease(gapp, v);
+ *   return sum;
+ * }
+ *
+ * Entries replaced by a version are kept on that version's
+ * retired list and freed once no older version is held, so the
+ * memory held is the newest tree plus what the oldest reader
+ * still needs. Adds and deletes must come from one thread at a
+ * time; GenAVLPersistAcquire and GenAVLPersistRelease may be
+ * called from any thread at any time.
+ *
+ * GenAVLPersistAdd returns 1, 0 if the key is already in the
+ * tree or -1 if memory ran out, in which case nothing changed.
+ * GenAVLPersistDelete returns the data of the entry removed, or
+ * 0. GenAVLPersistDestroy frees everything; no version may be
+ * held then.
+ *
+ ***************************************************************/
+typedef struct GENAVLPERSISTNODE {
+  GenAVLEntry entry;
+  unsigned long version;
+  struct GENAVLPERSISTNODE* next;
+} GenAVLPersistNode;
+
+typedef struct GENAVLPERSISTVERSION {
+  GenAVLEntry* root;
+  unsigned long version;
+  unsigned long refs;
+  GenAVLPersistNode* retired;
+  struct GENAVLPERSISTVERSION* next;
+} GenAVLPersistVersion;
+
+typedef struct {
+  GenAVLTree tree;
+  pthread_mutex_t lock;
+  GenAVLPersistVersion* oldest;
+  GenAVLPersistVersion* current;
+  GenAVLPersistNode* spare;
+  size_t nspare;
+} GenAVLPersist;
+
+int GenAVLPersistInit(GenAVLPersist*);
+void GenAVLPersistDestroy(GenAVLPersist*);
+int GenAVLPersistAdd(GenAVLPersist*, void*);
+void* GenAVLPersistDelete(GenAVLPersist*, const void*);
+GenAVLPersistVersion* GenAVLPersistAcquire(GenAVLPersist*);
+void GenAVLPersistRelease(GenAVLPersist*, GenAVLPersistVersion*);
+void GenAVLPersistView(GenAVLPersist*, GenAVLPersistVersion*, GenAVLTree*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GENAVL_PERSIST_H */
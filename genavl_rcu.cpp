@@ -0,0 +1,368 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+
+#include <thread>
+
+#include "genavl_rcu.h"
+#include "genavl_tree.h"
+
+using genavl::detail::c_policy;
+
+namespace {
+
+/***************************************************************
+ *
+ * Policy for the writer: each link is stored after a release
+ * fence, and any store but the first of an add, which links in
+ * the new entry, marks the tree as being restructured, making
+ * seq odd until the call is over. A rotation may link the new
+ * entry again, and that is marked. A delete has no new entry,
+ * so its first store marks it; even taking a leaf out is not
+ * safe unmarked there, since it may be the predecessor on its
+ * way to the place of the entry deleted.
+ *
+ ***************************************************************/
+struct rcu_policy : c_policy {
+  GenAVLRcu* garp;
+  GenAVLEntry* fresh;
+  int moving;
+
+  rcu_policy(GenAVLRcu* r, GenAVLEntry* f)
+      : c_policy(&r->tree), garp(r), fresh(f), moving(0) {}
+
+  void publish(node_ptr c) {
+    if (fresh && c == fresh) {
+      fresh = 0;
+    } else if (!moving) {
+      __atomic_store_n(&garp->seq, garp->seq + 1, __ATOMIC_RELAXED);
+      moving = 1;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+  }
+  void done() {
+    if (moving)
+      __atomic_store_n(&garp->seq, garp->seq + 1, __ATOMIC_RELEASE);
+  }
+
+  void set_root(node_ptr n) {
+    publish(n);
+    c_policy::set_root(n);
+  }
+  void set_left(node_ptr n, node_ptr c) {
+    publish(c);
+    c_policy::set_left(n, c);
+  }
+  void set_right(node_ptr n, node_ptr c) {
+    publish(c);
+    c_policy::set_right(n, c);
+  }
+};
+
+}  // namespace
+
+/*******************************************************
+ *
+ * Set up an empty tree whose removed entries are given
+ * to Free
+ *
+ *******************************************************/
+void GenAVLRcuInit(GenAVLRcu* garp, void (*Free)(GenAVLEntry*)) {
+  int i;
+
+  GenAVLTreeInit(&garp->tree, 0, 0);
+  garp->Free = Free;
+  garp->seq = 0;
+  garp->epoch = 1;
+  for (i = 0; i < 3; i++) {
+    garp->retired[i] = 0;
+    garp->nretired[i] = 0;
+    garp->maxretired[i] = 0;
+  }
+  for (i = 0; i < GENAVL_RCU_READERS; i++) {
+    garp->readers[i].epoch = 0;
+    garp->readers[i].used = 0;
+  }
+}
+
+/*******************************************************
+ *
+ * Give the entries retired in one epoch to Free
+ *
+ *******************************************************/
+static void GenAVLRcuFree(GenAVLRcu* garp, int b) {
+  size_t i;
+
+  for (i = 0; i < garp->nretired[b]; i++)
+    if (garp->Free)
+      garp->Free(garp->retired[b][i]);
+  garp->nretired[b] = 0;
+}
+
+/*******************************************************
+ *
+ * Free everything held. No reader may be in a section.
+ *
+ *******************************************************/
+void GenAVLRcuDestroy(GenAVLRcu* garp) {
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    GenAVLRcuFree(garp, i);
+    free(garp->retired[i]);
+    garp->retired[i] = 0;
+    garp->maxretired[i] = 0;
+  }
+}
+
+/*******************************************************
+ *
+ * Move the epoch on if every reader in a section entered
+ * it in the current one. Those retired in the epoch
+ * before can then no longer be reached by any reader,
+ * and their bucket is freed to take the next epoch's.
+ *
+ *******************************************************/
+void GenAVLRcuReclaim(GenAVLRcu* garp) {
+  unsigned long e = garp->epoch;
+  unsigned long r;
+  int i;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  for (i = 0; i < GENAVL_RCU_READERS; i++) {
+    r = __atomic_load_n(&garp->readers[i].epoch, __ATOMIC_ACQUIRE);
+    if (r && r != e)
+      return;
+  }
+  GenAVLRcuFree(garp, (int)((e + 2) % 3));
+  __atomic_store_n(&garp->epoch, e + 1, __ATOMIC_RELEASE);
+}
+
+/*******************************************************
+ *
+ * Hold a removed entry until no reader can be on it.
+ * Returns 0 if memory ran out, in which case the caller
+ * must wait out the readers itself.
+ *
+ *******************************************************/
+static int GenAVLRcuRetire(GenAVLRcu* garp, GenAVLEntry* gaep) {
+  int b = (int)(garp->epoch % 3);
+  GenAVLEntry** v;
+  size_t n;
+
+  if (garp->nretired[b] == garp->maxretired[b]) {
+    n = garp->maxretired[b] ? 2 * garp->maxretired[b] : 64;
+    if (!(v = (GenAVLEntry**)realloc(garp->retired[b], n * sizeof(*v))))
+      return 0;
+    garp->retired[b] = v;
+    garp->maxretired[b] = n;
+  }
+  garp->retired[b][garp->nretired[b]++] = gaep;
+  return 1;
+}
+
+/*******************************************************
+ *
+ * Add the entry to the tree. If there exists an entry
+ * with the same key already in the tree, return 0.
+ * Otherwise return 1.
+ *
+ *******************************************************/
+int GenAVLRcuAdd(GenAVLRcu* garp, GenAVLEntry* gae) {
+  rcu_policy p(garp, gae);
+  int r = genavl::detail::add(p, gae);
+
+  p.done();
+  return r;
+}
+
+/*******************************************************
+ *
+ * Remove the entry with the key from the tree and hand
+ * it to the reclaimer, returning its data pointer, or
+ * 0 if there is none. The entry and data must not be
+ * reused until Free is called for the entry. If the
+ * reclaimer cannot take it, wait for every reader to
+ * leave its section and free it here.
+ *
+ *******************************************************/
+void* GenAVLRcuDelete(GenAVLRcu* garp, const void* key) {
+  rcu_policy p(garp, 0);
+  GenAVLEntry* gaep = genavl::detail::erase(p, p.make_key(key));
+  unsigned long e = garp->epoch;
+  void* data;
+
+  p.done();
+  if (!gaep)
+    return 0;
+  data = gaep->data;
+  if (!GenAVLRcuRetire(garp, gaep)) {
+    while (garp->epoch < e + 2) {
+      std::this_thread::yield();
+      GenAVLRcuReclaim(garp);
+    }
+    if (garp->Free)
+      garp->Free(gaep);
+  }
+  GenAVLRcuReclaim(garp);
+  return data;
+}
+
+/*******************************************************
+ *
+ * Take a free reader slot, or return -1 if there is none
+ *
+ *******************************************************/
+int GenAVLRcuReaderRegister(GenAVLRcu* garp) {
+  int i;
+
+  for (i = 0; i < GENAVL_RCU_READERS; i++)
+    if (!__atomic_exchange_n(&garp->readers[i].used, 1, __ATOMIC_ACQ_REL))
+      return i;
+  return -1;
+}
+
+/*******************************************************
+ *
+ * Give back a reader slot
+ *
+ *******************************************************/
+void GenAVLRcuReaderUnregister(GenAVLRcu* garp, int slot) {
+  __atomic_store_n(&garp->readers[slot].epoch, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&garp->readers[slot].used, 0, __ATOMIC_RELEASE);
+}
+
+/*******************************************************
+ *
+ * Enter a read section by marking the slot with the
+ * epoch. The fence makes the mark seen by the writer
+ * before anything in the tree is read.
+ *
+ *******************************************************/
+void GenAVLRcuReadLock(GenAVLRcu* garp, int slot) {
+  __atomic_store_n(&garp->readers[slot].epoch,
+                   __atomic_load_n(&garp->epoch, __ATOMIC_ACQUIRE),
+                   __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*******************************************************
+ *
+ * Leave a read section
+ *
+ *******************************************************/
+void GenAVLRcuReadUnlock(GenAVLRcu* garp, int slot) {
+  __atomic_store_n(&garp->readers[slot].epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*******************************************************
+ *
+ * Descend the tree once, as GenAVLTreeFind does for a
+ * mode of 0, GenAVLTreeEqualNext for 1 and
+ * GenAVLTreeEqualPrev for -1. Returns 0 and sets *torn
+ * if the path is longer than any real one, which a
+ * rotation seen half done can cause.
+ *
+ *******************************************************/
+static GenAVLEntry* GenAVLRcuDescend(GenAVLRcu* garp,
+                                     c_policy& p,
+                                     const c_policy::key_type& key,
+                                     int mode,
+                                     int* torn) {
+  GenAVLEntry* gaep = garp->tree.root;
+  GenAVLEntry* best = 0;
+  int depth;
+  int dir;
+
+  for (depth = 0; gaep; depth++) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (depth == MAX_GENAVL_STACK) {
+      *torn = 1;
+      return 0;
+    }
+    if ((dir = p.compare(gaep, key)) == 0)
+      return gaep;
+    if (dir > 0) {
+      if (mode > 0)
+        best = gaep;
+      gaep = gaep->left;
+    } else {
+      if (mode < 0)
+        best = gaep;
+      gaep = gaep->right;
+    }
+  }
+  return best;
+}
+
+/*******************************************************
+ *
+ * Repeat the descent until no restructuring overlaps it
+ *
+ *******************************************************/
+static GenAVLEntry* GenAVLRcuRead(GenAVLRcu* garp, const void* key, int mode) {
+  c_policy p(&garp->tree);
+  c_policy::key_type k = p.make_key(key);
+  GenAVLEntry* gaep;
+  unsigned long s;
+  int torn;
+
+  for (;;) {
+    if ((s = __atomic_load_n(&garp->seq, __ATOMIC_ACQUIRE)) & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    torn = 0;
+    gaep = GenAVLRcuDescend(garp, p, k, mode, &torn);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (!torn && __atomic_load_n(&garp->seq, __ATOMIC_RELAXED) == s)
+      return gaep;
+  }
+}
+
+/*******************************************************
+ *
+ * Find the entry with the key, or return 0. Must be
+ * called within a read section.
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLRcuFind(GenAVLRcu* garp, const void* key) {
+  return GenAVLRcuRead(garp, key, 0);
+}
+
+/*******************************************************
+ *
+ * Return the least entry greater than or equal to the
+ * key. Must be called within a read section.
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLRcuEqualNext(GenAVLRcu* garp, const void* key) {
+  return GenAVLRcuRead(garp, key, 1);
+}
+
+/*******************************************************
+ *
+ * Return the greatest entry less than or equal to the
+ * key. Must be called within a read section.
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLRcuEqualPrev(GenAVLRcu* garp, const void* key) {
+  return GenAVLRcuRead(garp, key, -1);
+}
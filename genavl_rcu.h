@@ -0,0 +1,110 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GENAVL_RCU_H
+#define GENAVL_RCU_H
+
+#include "genavl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************************************************
+ *
+ * Trees with one writer and lock-free readers
+ *
+ * A GenAVLRcu is a tree changed by one thread and searched by
+ * any number of others at the same time, none of which take a
+ * lock. The writer makes its changes in place, with a release
+ * fence before every link it stores, so a reader following a
+ * new link finds the entry behind it fully set up. Linking a
+ * new entry in is a single store, which a reader either sees
+ * or not. Rotations and the removal of an entry move existing
+ * entries about, and while they do seq is odd; a reader whose
+ * descent overlapped one starts it again. Readers thus spend
+ * their time retrying only when a rotation is in progress, not
+ * on every add.
+ *
+ * Entries removed by GenAVLRcuDelete are not returned for reuse
+ * at once, as readers may still be on them. They are held until
+ * every reader that might have seen them has left its read
+ * section, then given to the Free method. This is epoch-based:
+ * each reader has a slot, taken with GenAVLRcuReaderRegister,
+ * in which it marks the epoch it entered at, and the epoch
+ * moves on, freeing what was removed two epochs before, once no
+ * reader is still in an earlier one. A reader that stays in its
+ * section holds up all freeing.
+ *
+ * void route(GenAVLRcu *rcu, int slot, long dest) {
+ *   GenAVLEntry *gaep;
+ *
+ *   GenAVLRcuReadLock(rcu, slot);
+ *   if ((gaep = GenAVLRcuFind(rcu, &dest)))
+ *     Forward((Route *)gaep->data);
+ *   GenAVLRcuReadUnlock(rcu, slot);
+ * }
+ *
+ * An entry found within a read section stays valid until the
+ * section ends, though it may be removed from the tree before
+ * then. Set the methods of tree before adding; the writer may
+ * also use tree itself with any call that does not change it.
+ * GenAVLRcuReclaim frees what can be freed and is called by
+ * GenAVLRcuDelete; GenAVLRcuDestroy frees all that is held and
+ * must be called with no reader in a section.
+ *
+ ***************************************************************/
+#define GENAVL_RCU_READERS 64
+
+typedef struct {
+  volatile unsigned long epoch;
+  volatile int used;
+  char pad[64 - sizeof(unsigned long) - sizeof(int)];
+} GenAVLRcuReader;
+
+typedef struct {
+  GenAVLTree tree;
+  void (*Free)(GenAVLEntry*);
+  volatile unsigned long seq;
+  volatile unsigned long epoch;
+  GenAVLEntry** retired[3];
+  size_t nretired[3];
+  size_t maxretired[3];
+  GenAVLRcuReader readers[GENAVL_RCU_READERS];
+} GenAVLRcu;
+
+void GenAVLRcuInit(GenAVLRcu*, void (*)(GenAVLEntry*));
+void GenAVLRcuDestroy(GenAVLRcu*);
+int GenAVLRcuAdd(GenAVLRcu*, GenAVLEntry*);
+void* GenAVLRcuDelete(GenAVLRcu*, const void*);
+void GenAVLRcuReclaim(GenAVLRcu*);
+int GenAVLRcuReaderRegister(GenAVLRcu*);
+void GenAVLRcuReaderUnregister(GenAVLRcu*, int);
+void GenAVLRcuReadLock(GenAVLRcu*, int);
+void GenAVLRcuReadUnlock(GenAVLRcu*, int);
+GenAVLEntry* GenAVLRcuFind(GenAVLRcu*, const void*);
+GenAVLEntry* GenAVLRcuEqualNext(GenAVLRcu*, const void*);
+GenAVLEntry* GenAVLRcuEqualPrev(GenAVLRcu*, const void*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GENAVL_RCU_H */
@@ -0,0 +1,476 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <string.h>
+
+#include <thread>
+
+#include "genavl_shard.h"
+
+/*******************************************************
+ *
+ * Set up one empty shard covering all keys, with the
+ * methods of the tree given. Returns 0 if keysize is 0
+ * or too large or there is no KeyCompare.
+ *
+ *******************************************************/
+int GenAVLShardedInit(GenAVLSharded* gasdp,
+                      GenAVLTree* methods,
+                      size_t keysize,
+                      size_t limit) {
+  GenAVLShard* gashp;
+  int i;
+
+  if (!keysize || keysize > GENAVL_SHARD_KEY || !methods->KeyCompare)
+    return 0;
+  gasdp->seq = 0;
+  gasdp->keysize = keysize;
+  gasdp->limit = limit < 16 ? 16 : limit;
+  pthread_mutex_init(&gasdp->relayout, 0);
+  for (i = 0; i < GENAVL_SHARD_MAX; i++) {
+    gashp = &gasdp->shards[i];
+    pthread_mutex_init(&gashp->lock, 0);
+    memcpy((void*)&gashp->tree, (void*)methods, sizeof(GenAVLTree));
+    gashp->tree.root = 0;
+    gashp->n = 0;
+    gashp->used = 0;
+  }
+  gasdp->shards[0].used = 1;
+  gasdp->order[0] = 0;
+  gasdp->nshards = 1;
+  return 1;
+}
+
+/*******************************************************
+ *
+ * Free the locks. The entries are left as they are.
+ *
+ *******************************************************/
+void GenAVLShardedDestroy(GenAVLSharded* gasdp) {
+  int i;
+
+  for (i = 0; i < GENAVL_SHARD_MAX; i++)
+    pthread_mutex_destroy(&gasdp->shards[i].lock);
+  pthread_mutex_destroy(&gasdp->relayout);
+}
+
+/*******************************************************
+ *
+ * Return the place of the shard in the order, or -1
+ *
+ *******************************************************/
+static int GenAVLShardedPos(GenAVLSharded* gasdp, int n, int slot) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (gasdp->order[i] == slot)
+      return i;
+  return -1;
+}
+
+/*******************************************************
+ *
+ * Lock and return the shard whose range holds the key,
+ * or, if strict, the one holding the keys just below
+ * it. A key of 0 locks the first shard if dir < 0 and
+ * the last otherwise. The ranges are read unlocked and
+ * are looked at again if seq shows they were changed
+ * before the lock was taken.
+ *
+ *******************************************************/
+static int GenAVLShardedLock(GenAVLSharded* gasdp,
+                             const void* key,
+                             int strict,
+                             int dir) {
+  GenAVLTree* gatp = &gasdp->shards[0].tree;
+  unsigned long s;
+  int lo;
+  int hi;
+  int mid;
+  int n;
+  int c;
+  int slot;
+
+  for (;;) {
+    if ((s = __atomic_load_n(&gasdp->seq, __ATOMIC_ACQUIRE)) & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    n = gasdp->nshards;
+    if (n < 1 || n > GENAVL_SHARD_MAX)
+      continue;
+    if (!key) {
+      lo = dir < 0 ? 0 : n - 1;
+    } else {
+      /* The last place whose lower bound is below the key */
+      for (lo = 0, hi = n - 1; lo < hi;) {
+        mid = (lo + hi + 1) / 2;
+        c = gatp->KeyCompare(gasdp->bound[gasdp->order[mid]], key);
+        if (c < 0 || (c == 0 && !strict))
+          lo = mid;
+        else
+          hi = mid - 1;
+      }
+    }
+    slot = gasdp->order[lo];
+    if (slot < 0 || slot >= GENAVL_SHARD_MAX)
+      continue;
+    pthread_mutex_lock(&gasdp->shards[slot].lock);
+    if (__atomic_load_n(&gasdp->seq, __ATOMIC_ACQUIRE) == s)
+      return slot;
+    pthread_mutex_unlock(&gasdp->shards[slot].lock);
+  }
+}
+
+/*******************************************************
+ *
+ * Split the locked shard at its middle key, moving the
+ * upper half to a free shard placed after it. Does
+ * nothing if another split or join is under way or
+ * there is no free shard.
+ *
+ *******************************************************/
+static void GenAVLShardedSplit(GenAVLSharded* gasdp, int slot) {
+  GenAVLShard* gashp = &gasdp->shards[slot];
+  GenAVLShard* gashpr;
+  GenAVLEntry* gaep;
+  char key[GENAVL_SHARD_KEY];
+  size_t nr;
+  int pos;
+  int n;
+  int i;
+  int r;
+
+  if (pthread_mutex_trylock(&gasdp->relayout))
+    return;
+  n = gasdp->nshards;
+  for (r = 0; r < GENAVL_SHARD_MAX && gasdp->shards[r].used; r++)
+    ;
+  if (r == GENAVL_SHARD_MAX) {
+    pthread_mutex_unlock(&gasdp->relayout);
+    return;
+  }
+  gashpr = &gasdp->shards[r];
+  pthread_mutex_lock(&gashpr->lock);
+
+#if defined(USE_GENAVL_COUNT)
+  gaep = GenAVLTreeSelect(&gashp->tree, gashp->n / 2);
+#else
+  gaep = gashp->tree.root;
+#endif
+  memcpy(key, gashp->tree.Key(gaep), gasdp->keysize);
+  gaep = GenAVLTreeSplit(&gashp->tree, key, &gashpr->tree);
+  GenAVLTreeAdd(&gashpr->tree, gaep);
+#if defined(USE_GENAVL_COUNT)
+  nr = GenAVLTreeCount(&gashpr->tree);
+#else
+  {
+    GenAVLDFIter gadfi;
+    void* data;
+
+    nr = 0;
+    for (data = GenAVLDFIterInitData(&gadfi, &gashpr->tree); data;
+         data = GenAVLDFIterNextData(&gadfi))
+      nr++;
+  }
+#endif
+  gashpr->n = nr;
+  gashp->n -= nr;
+
+  /* Publish the new range */
+  __atomic_store_n(&gasdp->seq, gasdp->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(gasdp->bound[r], key, gasdp->keysize);
+  pos = GenAVLShardedPos(gasdp, n, slot);
+  for (i = n; i > pos + 1; i--)
+    gasdp->order[i] = gasdp->order[i - 1];
+  gasdp->order[pos + 1] = r;
+  gasdp->nshards = n + 1;
+  gashpr->used = 1;
+  __atomic_store_n(&gasdp->seq, gasdp->seq + 1, __ATOMIC_RELEASE);
+
+  pthread_mutex_unlock(&gashpr->lock);
+  pthread_mutex_unlock(&gasdp->relayout);
+}
+
+/*******************************************************
+ *
+ * Join the locked shard with the one after it, or the
+ * one before it if it is last, if together they hold
+ * no more than half the limit. Does nothing if that
+ * shard or the ranges are busy.
+ *
+ *******************************************************/
+static void GenAVLShardedJoin(GenAVLSharded* gasdp, int slot) {
+  GenAVLShard* gashpl;
+  GenAVLShard* gashpr;
+  int other;
+  int pos;
+  int n;
+  int i;
+
+  if (pthread_mutex_trylock(&gasdp->relayout))
+    return;
+  n = gasdp->nshards;
+  pos = GenAVLShardedPos(gasdp, n, slot);
+  if (n < 2 || pos < 0) {
+    pthread_mutex_unlock(&gasdp->relayout);
+    return;
+  }
+  if (pos == n - 1)
+    pos--;
+  gashpl = &gasdp->shards[gasdp->order[pos]];
+  gashpr = &gasdp->shards[gasdp->order[pos + 1]];
+  other = gashpl == &gasdp->shards[slot] ? gasdp->order[pos + 1]
+                                         : gasdp->order[pos];
+  if (pthread_mutex_trylock(&gasdp->shards[other].lock)) {
+    pthread_mutex_unlock(&gasdp->relayout);
+    return;
+  }
+
+  if (gashpl->n + gashpr->n <= gasdp->limit / 2) {
+    GenAVLTreeJoin(&gashpl->tree, 0, &gashpr->tree);
+    gashpl->n += gashpr->n;
+    gashpr->n = 0;
+
+    /* Drop the upper range */
+    __atomic_store_n(&gasdp->seq, gasdp->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (i = pos + 1; i < n - 1; i++)
+      gasdp->order[i] = gasdp->order[i + 1];
+    gasdp->nshards = n - 1;
+    gashpr->used = 0;
+    __atomic_store_n(&gasdp->seq, gasdp->seq + 1, __ATOMIC_RELEASE);
+  }
+
+  pthread_mutex_unlock(&gasdp->shards[other].lock);
+  pthread_mutex_unlock(&gasdp->relayout);
+}
+
+/*******************************************************
+ *
+ * Add the entry to the shard holding its key. If there
+ * exists an entry with the same key already, return 0.
+ * Otherwise return 1.
+ *
+ *******************************************************/
+int GenAVLShardedAdd(GenAVLSharded* gasdp, GenAVLEntry* gae) {
+  int slot = GenAVLShardedLock(gasdp, gasdp->shards[0].tree.Key(gae), 0, 0);
+  GenAVLShard* gashp = &gasdp->shards[slot];
+  int r;
+
+  if ((r = GenAVLTreeAdd(&gashp->tree, gae)) && ++gashp->n > gasdp->limit &&
+      gasdp->nshards < GENAVL_SHARD_MAX)
+    GenAVLShardedSplit(gasdp, slot);
+  pthread_mutex_unlock(&gashp->lock);
+  return r;
+}
+
+/*******************************************************
+ *
+ * Delete the entry with the key from its shard and
+ * return its data pointer, or 0 if there is none
+ *
+ *******************************************************/
+void* GenAVLShardedDelete(GenAVLSharded* gasdp, const void* key) {
+  int slot = GenAVLShardedLock(gasdp, key, 0, 0);
+  GenAVLShard* gashp = &gasdp->shards[slot];
+  void* data;
+
+  if ((data = GenAVLTreeDelete(&gashp->tree, key)) &&
+      --gashp->n < gasdp->limit / 8 && gasdp->nshards > 1)
+    GenAVLShardedJoin(gasdp, slot);
+  pthread_mutex_unlock(&gashp->lock);
+  return data;
+}
+
+/*******************************************************
+ *
+ * Find the entry with the key, or return 0
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLShardedFind(GenAVLSharded* gasdp, const void* key) {
+  int slot = GenAVLShardedLock(gasdp, key, 0, 0);
+  GenAVLEntry* gaep = GenAVLTreeFind(&gasdp->shards[slot].tree, key);
+
+  pthread_mutex_unlock(&gasdp->shards[slot].lock);
+  return gaep;
+}
+
+/*******************************************************
+ *
+ * Return the number of entries, which is exact only
+ * when no add or delete is under way
+ *
+ *******************************************************/
+size_t GenAVLShardedCount(GenAVLSharded* gasdp) {
+  size_t n = 0;
+  int i;
+
+  for (i = 0; i < GENAVL_SHARD_MAX; i++)
+    n += __atomic_load_n(&gasdp->shards[i].n, __ATOMIC_RELAXED);
+  return n;
+}
+
+/*******************************************************
+ *
+ * Go on from the shard the iterator is in while it has
+ * nothing more to give, in the direction given: copy
+ * the bound it shares with the next shard that way,
+ * let it go and lock the shard that now holds the keys
+ * past the bound. Returns 0 at the end of the shards.
+ *
+ *******************************************************/
+static void* GenAVLShardedIterMove(GenAVLShardedIter* gasdip,
+                                   void* data,
+                                   int dir) {
+  GenAVLSharded* gasdp = gasdip->gasdp;
+  char key[GENAVL_SHARD_KEY];
+  unsigned long s;
+  int pos;
+  int n;
+
+  while (!data && gasdip->slot >= 0) {
+    /* The bound is fixed while the shard is locked, but
+     * its place in the order is not */
+    do {
+      while ((s = __atomic_load_n(&gasdp->seq, __ATOMIC_ACQUIRE)) & 1)
+        std::this_thread::yield();
+      n = gasdp->nshards;
+      pos = GenAVLShardedPos(gasdp, n, gasdip->slot);
+      if (pos >= 0 && dir > 0 && pos < n - 1)
+        memcpy(key, gasdp->bound[gasdp->order[pos + 1]], gasdp->keysize);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&gasdp->seq, __ATOMIC_RELAXED) != s);
+    if (dir < 0 && pos > 0)
+      memcpy(key, gasdp->bound[gasdip->slot], gasdp->keysize);
+
+    pthread_mutex_unlock(&gasdp->shards[gasdip->slot].lock);
+    gasdip->slot = -1;
+    if (dir > 0 ? pos == n - 1 : pos == 0)
+      break;
+    gasdip->slot = GenAVLShardedLock(gasdp, key, dir < 0, 0);
+    if (dir > 0)
+      data = GenAVLDFIterInitNextEqualData(
+          &gasdip->df, &gasdp->shards[gasdip->slot].tree, key);
+    else
+      data = GenAVLDFIterInitPrevData(&gasdip->df,
+                                      &gasdp->shards[gasdip->slot].tree, key);
+  }
+  return data;
+}
+
+/*******************************************************
+ *
+ * Start at the first entry
+ *
+ *******************************************************/
+void* GenAVLShardedIterInitData(GenAVLShardedIter* gasdip,
+                                GenAVLSharded* gasdp) {
+  gasdip->gasdp = gasdp;
+  gasdip->slot = GenAVLShardedLock(gasdp, 0, 0, -1);
+  return GenAVLShardedIterMove(
+      gasdip,
+      GenAVLDFIterInitData(&gasdip->df, &gasdp->shards[gasdip->slot].tree),
+      1);
+}
+
+/*******************************************************
+ *
+ * Start at the first entry greater than or equal to
+ * the key
+ *
+ *******************************************************/
+void* GenAVLShardedIterInitNextEqualData(GenAVLShardedIter* gasdip,
+                                         GenAVLSharded* gasdp,
+                                         const void* key) {
+  gasdip->gasdp = gasdp;
+  gasdip->slot = GenAVLShardedLock(gasdp, key, 0, 0);
+  return GenAVLShardedIterMove(
+      gasdip,
+      GenAVLDFIterInitNextEqualData(&gasdip->df,
+                                    &gasdp->shards[gasdip->slot].tree, key),
+      1);
+}
+
+/*******************************************************
+ *
+ * Step to the next entry
+ *
+ *******************************************************/
+void* GenAVLShardedIterNextData(GenAVLShardedIter* gasdip) {
+  if (gasdip->slot < 0)
+    return 0;
+  return GenAVLShardedIterMove(gasdip, GenAVLDFIterNextData(&gasdip->df), 1);
+}
+
+/*******************************************************
+ *
+ * Start at the last entry
+ *
+ *******************************************************/
+void* GenAVLShardedIterInitLastData(GenAVLShardedIter* gasdip,
+                                    GenAVLSharded* gasdp) {
+  gasdip->gasdp = gasdp;
+  gasdip->slot = GenAVLShardedLock(gasdp, 0, 0, 1);
+  return GenAVLShardedIterMove(
+      gasdip,
+      GenAVLDFIterInitLastData(&gasdip->df, &gasdp->shards[gasdip->slot].tree),
+      -1);
+}
+
+/*******************************************************
+ *
+ * Start at the last entry less than or equal to the key
+ *
+ *******************************************************/
+void* GenAVLShardedIterInitPrevEqualData(GenAVLShardedIter* gasdip,
+                                         GenAVLSharded* gasdp,
+                                         const void* key) {
+  gasdip->gasdp = gasdp;
+  gasdip->slot = GenAVLShardedLock(gasdp, key, 0, 0);
+  return GenAVLShardedIterMove(
+      gasdip,
+      GenAVLDFIterInitPrevEqualData(&gasdip->df,
+                                    &gasdp->shards[gasdip->slot].tree, key),
+      -1);
+}
+
+/*******************************************************
+ *
+ * Step to the previous entry
+ *
+ *******************************************************/
+void* GenAVLShardedIterPrevData(GenAVLShardedIter* gasdip) {
+  if (gasdip->slot < 0)
+    return 0;
+  return GenAVLShardedIterMove(gasdip, GenAVLDFIterPrevData(&gasdip->df), -1);
+}
+
+/*******************************************************
+ *
+ * Let go of the shard the iterator is in, when it is
+ * left before it returns 0
+ *
+ *******************************************************/
+void GenAVLShardedIterEnd(GenAVLShardedIter* gasdip) {
+  if (gasdip->slot >= 0)
+    pthread_mutex_unlock(&gasdip->gasdp->shards[gasdip->slot].lock);
+  gasdip->slot = -1;
+}
@@ -0,0 +1,136 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GENAVL_SHARD_H
+#define GENAVL_SHARD_H
+
+#include <pthread.h>
+
+#include "genavl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************************************************
+ *
+ * Range-sharded trees
+ *
+ * A GenAVLSharded splits the key space into ranges, each held in
+ * its own GenAVLTree, a shard, with its own lock, so writers
+ * whose keys fall in different ranges do not wait for one
+ * another. Each call locks the one shard whose range holds the
+ * key. Finding that shard reads the ranges without a lock: they
+ * change only under seq, which a call notes before it looks and
+ * checks once it holds the shard's lock, looking again if the
+ * ranges have changed in between.
+ *
+ * The lowest key of each range but the first is copied into the
+ * GenAVLSharded, so keys must be of a fixed size, keysize bytes
+ * at the pointer Key returns, and at most GENAVL_SHARD_KEY of
+ * them; KeyCompare must be set, as it compares those copies.
+ * Compare and KeyCompare may be shown a copy being rewritten,
+ * and must not go wrong whatever bytes it holds.
+ *
+ * A shard that grows past limit entries is split in two at its
+ * middle key with GenAVLTreeSplit, and one that shrinks below an
+ * eighth of limit is joined to a neighbour with GenAVLTreeJoin
+ * if they fit in half of limit together. Both happen within the
+ * add or delete that crosses the bound, take O(log n) and hold
+ * up only the shards involved. Splits stop once there are
+ * GENAVL_SHARD_MAX shards. With USE_GENAVL_COUNT the middle key
+ * is exact; without it the root of the shard is taken, and the
+ * entries moved are counted one by one.
+ *
+ * The methods of the GenAVLTree given to GenAVLShardedInit are
+ * copied into each shard; its root is not used.
+ *
+ * GenAVLShardedIter walks the entries of all the shards in
+ * order, as GenAVLDFIter does those of one tree, and is used the
+ * same way:
+ *
+ * void walk(GenAVLSharded *gasdp) {
+ *   GenAVLShardedIter gasdi;
+ *   MyData *data;
+ *
+ *   for (data = GenAVLShardedIterInitData(&gasdi, gasdp); data;
+ *        data = GenAVLShardedIterNextData(&gasdi))
+ *     DoSomething(data);
+ * }
+ *
+ * The iterator holds the lock of the shard it is in between
+ * calls, so each shard is seen whole, but adds and deletes in
+ * other shards go on meanwhile. It must not be used with calls
+ * that change the GenAVLSharded from the same thread, and if it
+ * is left before it returns 0, GenAVLShardedIterEnd must be
+ * called to let the lock go.
+ *
+ ***************************************************************/
+#define GENAVL_SHARD_MAX 64
+#define GENAVL_SHARD_KEY 64
+
+typedef struct {
+  pthread_mutex_t lock;
+  GenAVLTree tree;
+  size_t n;
+  int used;
+  char pad[64];
+} GenAVLShard;
+
+typedef struct {
+  volatile unsigned long seq;
+  volatile int nshards;
+  volatile int order[GENAVL_SHARD_MAX];
+  char bound[GENAVL_SHARD_MAX][GENAVL_SHARD_KEY];
+  size_t keysize;
+  size_t limit;
+  pthread_mutex_t relayout;
+  GenAVLShard shards[GENAVL_SHARD_MAX];
+} GenAVLSharded;
+
+typedef struct {
+  GenAVLDFIter df;
+  GenAVLSharded* gasdp;
+  int slot;
+} GenAVLShardedIter;
+
+int GenAVLShardedInit(GenAVLSharded*, GenAVLTree*, size_t, size_t);
+void GenAVLShardedDestroy(GenAVLSharded*);
+int GenAVLShardedAdd(GenAVLSharded*, GenAVLEntry*);
+void* GenAVLShardedDelete(GenAVLSharded*, const void*);
+GenAVLEntry* GenAVLShardedFind(GenAVLSharded*, const void*);
+size_t GenAVLShardedCount(GenAVLSharded*);
+void* GenAVLShardedIterInitData(GenAVLShardedIter*, GenAVLSharded*);
+void* GenAVLShardedIterInitNextEqualData(GenAVLShardedIter*,
+                                         GenAVLSharded*,
+                                         const void*);
+void* GenAVLShardedIterNextData(GenAVLShardedIter*);
+void* GenAVLShardedIterInitLastData(GenAVLShardedIter*, GenAVLSharded*);
+void* GenAVLShardedIterInitPrevEqualData(GenAVLShardedIter*,
+                                         GenAVLSharded*,
+                                         const void*);
+void* GenAVLShardedIterPrevData(GenAVLShardedIter*);
+void GenAVLShardedIterEnd(GenAVLShardedIter*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GENAVL_SHARD_H */
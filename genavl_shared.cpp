@@ -0,0 +1,383 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <errno.h>
+#include <stdint.h>
+
+#include <thread>
+
+#include "genavl_shared.h"
+
+using genavl::detail::c_policy;
+
+namespace {
+
+/***************************************************************
+ *
+ * Policy for the writers: as for the C entry points, but with
+ * the root kept in the GenAVLShared
+ *
+ ***************************************************************/
+struct shared_policy : c_policy {
+  GenAVLShared* gasp;
+
+  shared_policy(GenAVLShared* s, GenAVLTree* t) : c_policy(t), gasp(s) {}
+
+  node_ptr root() const { return gasp->root; }
+  void set_root(node_ptr n) {
+    gasp->root = n;
+#if defined(USE_GENAVL_PARENT)
+    if (n)
+      n->parent = 0;
+#endif
+  }
+};
+
+typedef genavl::detail::log_policy<shared_policy> shared_log_policy;
+
+}  // namespace
+
+/*******************************************************
+ *
+ * Set up an empty shared tree over the region of size
+ * bytes at base, which must hold the GenAVLShared
+ * itself. Returns 1, or 0 if the lock cannot be made.
+ *
+ *******************************************************/
+int GenAVLSharedInit(GenAVLShared* gasp, void* base, size_t size) {
+  pthread_mutexattr_t attr;
+  int r;
+
+  if ((char*)gasp < (char*)base ||
+      (char*)(gasp + 1) > (char*)base + size ||
+      pthread_mutexattr_init(&attr) != 0)
+    return 0;
+  r = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) == 0 &&
+      pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST) == 0 &&
+      pthread_mutex_init(&gasp->lock, &attr) == 0;
+  pthread_mutexattr_destroy(&attr);
+  gasp->seq = 0;
+  gasp->root = 0;
+  gasp->base = (char*)base;
+  gasp->size = size;
+  gasp->log.n = 0;
+  return r;
+}
+
+/*******************************************************
+ *
+ * Repair the tree after its writer died holding the
+ * lock, which is now held instead: undo the change it
+ * was making and leave seq even again, and different
+ * from what any reader saw before
+ *
+ *******************************************************/
+static void GenAVLSharedRecover(GenAVLShared* gasp) {
+  genavl::detail::undo_log(&gasp->log, (char*)gasp->base, gasp->size);
+  if (gasp->seq & 1)
+    __atomic_store_n(&gasp->seq, gasp->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*******************************************************
+ *
+ * Finish taking the lock given the result r of locking
+ * it: if the last holder died, repair the tree and mark
+ * the lock consistent. Returns 0 with the lock held, or
+ * an error number with it not held.
+ *
+ *******************************************************/
+static int GenAVLSharedTaken(GenAVLShared* gasp, int r) {
+  if (r == EOWNERDEAD) {
+    GenAVLSharedRecover(gasp);
+    if ((r = pthread_mutex_consistent(&gasp->lock)) != 0)
+      pthread_mutex_unlock(&gasp->lock);
+  }
+  return r;
+}
+
+/*******************************************************
+ *
+ * Take the writer lock, repairing the tree first if the
+ * last holder died, and make seq odd. The fence keeps
+ * the changes that follow from being seen before seq.
+ * Returns 0, or an error number if the lock could not
+ * be taken, in which case the tree must not be touched.
+ *
+ *******************************************************/
+static int GenAVLSharedLock(GenAVLShared* gasp) {
+  int r;
+
+  if ((r = GenAVLSharedTaken(gasp, pthread_mutex_lock(&gasp->lock))) != 0)
+    return r;
+  __atomic_store_n(&gasp->seq, gasp->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return 0;
+}
+
+/*******************************************************
+ *
+ * Empty the log, make seq even and drop the lock
+ *
+ *******************************************************/
+static void GenAVLSharedUnlock(GenAVLShared* gasp, shared_log_policy& p) {
+  p.commit();
+  __atomic_store_n(&gasp->seq, gasp->seq + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&gasp->lock);
+}
+
+/*******************************************************
+ *
+ * Add the entry to the shared tree. If there exists an
+ * entry with the same key already in the tree, return
+ * 0, or -1 if the lock could not be taken. Otherwise
+ * return 1.
+ *
+ *******************************************************/
+int GenAVLSharedAdd(GenAVLShared* gasp, GenAVLTree* gatp, GenAVLEntry* gae) {
+  shared_log_policy p(shared_policy(gasp, gatp), &gasp->log,
+                      (char*)gasp->base, &gasp->root);
+  int r;
+
+  if (GenAVLSharedLock(gasp) != 0)
+    return -1;
+  r = genavl::detail::add(p, gae);
+  GenAVLSharedUnlock(gasp, p);
+  return r;
+}
+
+/*******************************************************
+ *
+ * Delete the entry with the key from the shared tree
+ * and return its data pointer, 0 if there is none or
+ * GENAVL_SHARED_FAILED if the lock could not be taken
+ *
+ *******************************************************/
+void* GenAVLSharedDelete(GenAVLShared* gasp,
+                         GenAVLTree* gatp,
+                         const void* key) {
+  shared_log_policy p(shared_policy(gasp, gatp), &gasp->log,
+                      (char*)gasp->base, &gasp->root);
+  GenAVLEntry* gaep;
+
+  if (GenAVLSharedLock(gasp) != 0)
+    return GENAVL_SHARED_FAILED;
+  gaep = genavl::detail::erase(p, p.make_key(key));
+  GenAVLSharedUnlock(gasp, p);
+  return gaep ? (void*)gaep->data : 0;
+}
+
+/*******************************************************
+ *
+ * Wait until no writer holds the tree and return seq.
+ * After waiting a while, try the lock in case the
+ * writer has died and needs undoing.
+ *
+ *******************************************************/
+unsigned int GenAVLSharedReadBegin(GenAVLShared* gasp) {
+  unsigned int spins = 0;
+  unsigned int s;
+  int r;
+
+  while ((s = __atomic_load_n(&gasp->seq, __ATOMIC_ACQUIRE)) & 1) {
+    if (++spins % GENAVL_SHARED_SPINS == 0 &&
+        (r = pthread_mutex_trylock(&gasp->lock)) != EBUSY &&
+        GenAVLSharedTaken(gasp, r) == 0)
+      pthread_mutex_unlock(&gasp->lock);
+    std::this_thread::yield();
+  }
+  return s;
+}
+
+/*******************************************************
+ *
+ * Return 1 if a writer has been at the tree since the
+ * GenAVLSharedReadBegin which returned seq
+ *
+ *******************************************************/
+int GenAVLSharedReadRetry(GenAVLShared* gasp, unsigned int seq) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&gasp->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/*******************************************************
+ *
+ * Return 1 if the entry lies wholly within the region
+ * and its data starts there
+ *
+ *******************************************************/
+static int GenAVLSharedValid(GenAVLShared* gasp, GenAVLEntry* gaep) {
+  char* lo = gasp->base;
+  char* hi = lo + gasp->size;
+  char* dp;
+
+  if ((char*)gaep < lo || (char*)(gaep + 1) > hi ||
+      ((uintptr_t)gaep & (sizeof(void*) - 1)))
+    return 0;
+  dp = (char*)(void*)gaep->data;
+  return dp >= lo && dp < hi;
+}
+
+/*******************************************************
+ *
+ * Descend the tree once without the lock. The mode
+ * picks the result: 0 for an equal entry, 1 and 2 for
+ * the least greater or equal and greater, -1 and -2 for
+ * the greatest less or equal and less. A null
+ * key lies before every entry for the positive modes
+ * and after every one for the negative. Sets *torn and
+ * gives up if an entry is out of the region or the
+ * path is too long to be a path of a real tree.
+ *
+ *******************************************************/
+static GenAVLEntry* GenAVLSharedDescend(GenAVLShared* gasp,
+                                        c_policy& p,
+                                        const c_policy::key_type& key,
+                                        int null,
+                                        int mode,
+                                        int* torn) {
+  GenAVLEntry* gaep = gasp->root;
+  GenAVLEntry* best = 0;
+  int depth;
+  int dir;
+
+  for (depth = 0; gaep; depth++) {
+    if (depth == MAX_GENAVL_STACK || !GenAVLSharedValid(gasp, gaep)) {
+      *torn = 1;
+      return 0;
+    }
+    dir = null ? mode : p.compare(gaep, key);
+    if (dir == 0) {
+      if (mode == 2)
+        dir = -1;
+      else if (mode == -2)
+        dir = 1;
+      else
+        return gaep;
+    }
+    if (dir > 0) {
+      if (mode > 0)
+        best = gaep;
+      gaep = gaep->left;
+    } else {
+      if (mode < 0)
+        best = gaep;
+      gaep = gaep->right;
+    }
+  }
+  return best;
+}
+
+/*******************************************************
+ *
+ * Repeat the descent until it is made with no writer
+ * at the tree
+ *
+ *******************************************************/
+static GenAVLEntry* GenAVLSharedRead(GenAVLShared* gasp,
+                                     GenAVLTree* gatp,
+                                     const void* key,
+                                     int mode) {
+  c_policy p(gatp);
+  c_policy::key_type k = p.make_key(key);
+  GenAVLEntry* gaep;
+  unsigned int s;
+  int torn;
+
+  do {
+    s = GenAVLSharedReadBegin(gasp);
+    torn = 0;
+    gaep = GenAVLSharedDescend(gasp, p, k, key == 0, mode, &torn);
+  } while (GenAVLSharedReadRetry(gasp, s) || torn);
+  return gaep;
+}
+
+/*******************************************************
+ *
+ * Find the entry with the key, or return 0
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLSharedFind(GenAVLShared* gasp,
+                              GenAVLTree* gatp,
+                              const void* key) {
+  return GenAVLSharedRead(gasp, gatp, key, 0);
+}
+
+/*******************************************************
+ *
+ * Return the first entry, or 0 if the tree is empty
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLSharedFirst(GenAVLShared* gasp, GenAVLTree* gatp) {
+  return GenAVLSharedRead(gasp, gatp, 0, 1);
+}
+
+/*******************************************************
+ *
+ * Return the last entry, or 0 if the tree is empty
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLSharedLast(GenAVLShared* gasp, GenAVLTree* gatp) {
+  return GenAVLSharedRead(gasp, gatp, 0, -1);
+}
+
+/*******************************************************
+ *
+ * Return the least entry greater than the key
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLSharedNext(GenAVLShared* gasp,
+                              GenAVLTree* gatp,
+                              const void* key) {
+  return GenAVLSharedRead(gasp, gatp, key, 2);
+}
+
+/*******************************************************
+ *
+ * Return the least entry greater than or equal to the
+ * key
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLSharedEqualNext(GenAVLShared* gasp,
+                                   GenAVLTree* gatp,
+                                   const void* key) {
+  return GenAVLSharedRead(gasp, gatp, key, 1);
+}
+
+/*******************************************************
+ *
+ * Return the greatest entry less than the key
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLSharedPrev(GenAVLShared* gasp,
+                              GenAVLTree* gatp,
+                              const void* key) {
+  return GenAVLSharedRead(gasp, gatp, key, -2);
+}
+
+/*******************************************************
+ *
+ * Return the greatest entry less than or equal to the
+ * key
+ *
+ *******************************************************/
+GenAVLEntry* GenAVLSharedEqualPrev(GenAVLShared* gasp,
+                                   GenAVLTree* gatp,
+                                   const void* key) {
+  return GenAVLSharedRead(gasp, gatp, key, -1);
+}
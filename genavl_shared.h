@@ -0,0 +1,127 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GENAVL_SHARED_H
+#define GENAVL_SHARED_H
+
+#include <pthread.h>
+
+#include "genavl.h"
+#include "genavl_log.h"
+
+#if !defined(USE_OFFSET_PTR)
+#error "genavl_shared.h needs USE_OFFSET_PTR: a region may be mapped anywhere"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/***************************************************************
+ *
+ * Shared trees
+ *
+ * A GenAVLShared holds the root of a tree used by several
+ * processes through shared memory, along with what they need
+ * to take turns with it. It, the entries and their data must
+ * all lie within one region of shared memory, such as one
+ * managed by a GenAVLArena, whose bounds are given to
+ * GenAVLSharedInit by whichever process sets it up. Each
+ * process passes its own GenAVLTree to the calls below for its
+ * Compare, Key, Augment and Prefix methods, which are local to
+ * it; the root of that GenAVLTree is not used.
+ *
+ * GenAVLSharedAdd and GenAVLSharedDelete are writers. They take
+ * a robust, process-shared mutex, so that if a writer dies
+ * holding it the next one to take it learns so, undoes the dead
+ * writer's half-made change from the undo log kept here and
+ * carries on. While it holds the lock a writer keeps seq odd.
+ * If the lock cannot be taken, as when it has been left not
+ * recoverable, the tree is not touched: GenAVLSharedAdd returns
+ * -1 and GenAVLSharedDelete returns GENAVL_SHARED_FAILED.
+ *
+ * GenAVLSharedFind, GenAVLSharedFirst, GenAVLSharedNext and the
+ * rest are optimistic readers, which take no lock and write
+ * nothing shared. Each notes seq, waiting while it is odd,
+ * descends the tree and starts again if seq has changed by the
+ * end, as the descent may then have seen a change half made.
+ * Every entry is checked to be within the region before it is
+ * read, so a torn link cannot lead a reader astray, but Compare
+ * may be shown an entry that has since been deleted and reused
+ * and must not go wrong on whatever its data holds then. The
+ * entry returned was in the tree when the descent ended; it may
+ * be deleted at any moment after. To read its data consistently,
+ * bracket the call and the reads with GenAVLSharedReadBegin and
+ * GenAVLSharedReadRetry, and repeat them while it returns 1:
+ *
+ * long lookup(GenAVLShared *gasp, GenAVLTree *methods, long k) {
+ *   unsigned int seq;
+ *   GenAVLEntry *gaep;
+ *   long v;
+ *
+ *   do {
+ *     seq = GenAVLSharedReadBegin(gasp);
+ *     gaep = GenAVLSharedFind(gasp, methods, &k);
+ *     v = gaep ? ((MyData *)gaep->data)->value : -1;
+ *   } while (GenAVLSharedReadRetry(gasp, seq));
+ *   return v;
+ * }
+ *
+ * To iterate, start with GenAVLSharedFirst or GenAVLSharedLast
+ * and pass a copy of the key of each entry returned to
+ * GenAVLSharedNext or GenAVLSharedPrev; each step is a fresh
+ * descent, so entries added and deleted meanwhile are seen or
+ * not, but the keys always come in order.
+ *
+ * A reader that waits GENAVL_SHARED_SPINS times for a writer
+ * tries the lock, so that a writer which died is repaired even
+ * when no other writer comes along.
+ *
+ ***************************************************************/
+#define GENAVL_SHARED_SPINS 4096
+#define GENAVL_SHARED_FAILED ((void*)-1)
+
+typedef struct {
+  pthread_mutex_t lock;
+  volatile unsigned int seq;
+  offset_ptr<GenAVLEntry> root;
+  offset_ptr<char> base;
+  size_t size;
+  GenAVLLog log;
+} GenAVLShared;
+
+int GenAVLSharedInit(GenAVLShared*, void*, size_t);
+int GenAVLSharedAdd(GenAVLShared*, GenAVLTree*, GenAVLEntry*);
+void* GenAVLSharedDelete(GenAVLShared*, GenAVLTree*, const void*);
+GenAVLEntry* GenAVLSharedFind(GenAVLShared*, GenAVLTree*, const void*);
+GenAVLEntry* GenAVLSharedFirst(GenAVLShared*, GenAVLTree*);
+GenAVLEntry* GenAVLSharedLast(GenAVLShared*, GenAVLTree*);
+GenAVLEntry* GenAVLSharedNext(GenAVLShared*, GenAVLTree*, const void*);
+GenAVLEntry* GenAVLSharedEqualNext(GenAVLShared*, GenAVLTree*, const void*);
+GenAVLEntry* GenAVLSharedPrev(GenAVLShared*, GenAVLTree*, const void*);
+GenAVLEntry* GenAVLSharedEqualPrev(GenAVLShared*, GenAVLTree*, const void*);
+unsigned int GenAVLSharedReadBegin(GenAVLShared*);
+int GenAVLSharedReadRetry(GenAVLShared*, unsigned int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GENAVL_SHARED_H */
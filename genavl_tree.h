@@ -0,0 +1,2218 @@
+/* Copyright (c) 2006, Jim Tsillas
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jim Tsillas ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Jim Tsillas BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef GENAVL_TREE_H
+#define GENAVL_TREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "genavl.h"
+
+/***************************************************************
+ *
+ * genavl_tree.h holds the AVL algorithms used by the GenAVLTree
+ * C entry points as templates, together with genavl::tree, a
+ * typed intrusive front-end whose comparator is known at compile
+ * time and can therefore be inlined into the descent.
+ *
+ * The algorithms in genavl::detail are parameterized on a policy
+ * object which supplies all access to the nodes and the tree:
+ *
+ *   node_ptr                - handle to a node (GenAVLEntry*)
+ *   key_type                - key handle passed to compare
+ *   root(), set_root(n)     - read and write the tree root
+ *   left(n), set_left(n, c) - read and write the left link
+ *   right(n), set_right(n, c)
+ *   balance(n), set_balance(n, b)
+ *   init(n)                 - clear the links of a new node
+ *   fix(n)                  - recompute anything kept per node
+ *                             over its subtree, such as the
+ *                             count, from its children
+ *   key(n)                  - key of the given node
+ *   compare(n, k)           - <0, 0 or >0 as the node is less
+ *                             than, equal to or greater than k
+ *   parent(n)               - the node above n, with
+ *                             USE_GENAVL_PARENT only; set_root,
+ *                             set_left and set_right keep it
+ *
+ * add_unbal, which keeps no path of its own, also needs:
+ *
+ *   augmented()             - true if fix does more than keep
+ *                             the count, with USE_GENAVL_AUGMENT
+ *                             only
+ *   grow(n)                 - add one to the count of n, with
+ *                             USE_GENAVL_COUNT only
+ *
+ * The algorithms never touch a node other than through the
+ * policy, so the C wrappers in genavl.cpp and genavl::tree
+ * run exactly the same code over the same GenAVLEntry layout.
+ *
+ ***************************************************************/
+namespace genavl {
+namespace detail {
+
+/***********************************************
+ *
+ * The stack_entry is a private structure
+ * used to keep track of the path to a
+ * node which is to be removed from the
+ * tree. This path is useful in rebalancing the
+ * tree after the entry has been removed.
+ *
+ ***********************************************/
+template <class NodePtr>
+struct stack_entry {
+  NodePtr e;
+  int d;
+};
+
+/***********************************************
+ *
+ * A path of nodes for walks which may be
+ * deeper than MAX_GENAVL_STACK, as in a tree
+ * that is not balanced. It starts out in place
+ * and moves to the heap as it grows.
+ *
+ ***********************************************/
+template <class NodePtr>
+class path_buffer {
+ public:
+  path_buffer() : path_(inline_), n_(0), max_(MAX_GENAVL_STACK) {}
+  ~path_buffer() {
+    if (path_ != inline_)
+      std::free(path_);
+  }
+
+  /* Returns false if there is no memory to grow */
+  bool push(NodePtr n) {
+    if (n_ == max_ && !grow())
+      return false;
+    path_[n_++] = n;
+    return true;
+  }
+  bool empty() const { return !n_; }
+  NodePtr pop() { return path_[--n_]; }
+
+ private:
+  path_buffer(const path_buffer&);
+  path_buffer& operator=(const path_buffer&);
+
+  bool grow() {
+    NodePtr* p = (NodePtr*)std::malloc(2 * max_ * sizeof(NodePtr));
+
+    if (!p)
+      return false;
+    std::memcpy((void*)p, (void*)path_, n_ * sizeof(NodePtr));
+    if (path_ != inline_)
+      std::free(path_);
+    path_ = p;
+    max_ *= 2;
+    return true;
+  }
+
+  NodePtr inline_[MAX_GENAVL_STACK];
+  NodePtr* path_;
+  size_t n_;
+  size_t max_;
+};
+
+/***************************************************************
+ *
+ * Node and root access for GenAVLEntry trees rooted in a
+ * GenAVLTree. Comparison is left to the derived policies.
+ *
+ ***************************************************************/
+struct entry_policy {
+  typedef GenAVLEntry* node_ptr;
+
+  GenAVLTree* gatp;
+
+  explicit entry_policy(GenAVLTree* t) : gatp(t) {}
+
+  node_ptr root() const { return gatp->root; }
+#if defined(USE_GENAVL_PARENT)
+  node_ptr parent(node_ptr n) const { return n->parent; }
+  void set_root(node_ptr n) {
+    gatp->root = n;
+    if (n)
+      n->parent = 0;
+  }
+  void set_left(node_ptr n, node_ptr c) {
+    n->left = c;
+    if (c)
+      c->parent = n;
+  }
+  void set_right(node_ptr n, node_ptr c) {
+    n->right = c;
+    if (c)
+      c->parent = n;
+  }
+#else
+  void set_root(node_ptr n) { gatp->root = n; }
+  void set_left(node_ptr n, node_ptr c) { n->left = c; }
+  void set_right(node_ptr n, node_ptr c) { n->right = c; }
+#endif
+  node_ptr left(node_ptr n) const { return n->left; }
+  node_ptr right(node_ptr n) const { return n->right; }
+  int balance(node_ptr n) const { return n->balance; }
+  void set_balance(node_ptr n, int b) { n->balance = b; }
+  void init(node_ptr n) {
+    n->left = 0;
+    n->right = 0;
+    n->balance = 0;
+#if defined(USE_GENAVL_COUNT)
+    n->count = 1;
+#endif
+#if defined(USE_GENAVL_PARENT)
+    n->parent = 0;
+#endif
+#if defined(USE_GENAVL_PREFIX)
+    n->prefix = gatp->Prefix ? gatp->Prefix(gatp->Key(n)) : 0;
+#endif
+  }
+#if defined(USE_GENAVL_AUGMENT)
+  bool augmented() const { return gatp->Augment != 0; }
+#endif
+#if defined(USE_GENAVL_COUNT)
+  void grow(node_ptr n) { n->count++; }
+#endif
+  void fix(node_ptr n) {
+#if defined(USE_GENAVL_COUNT)
+    GenAVLEntry* l = n->left;
+    GenAVLEntry* r = n->right;
+
+    n->count = 1 + (l ? l->count : 0) + (r ? r->count : 0);
+#endif
+#if defined(USE_GENAVL_AUGMENT)
+    if (gatp->Augment)
+      gatp->Augment(n);
+#endif
+    (void)n;
+  }
+#if defined(USE_GENAVL_COUNT)
+  size_t count(node_ptr n) const { return n ? n->count : 0; }
+#endif
+};
+
+/***************************************************************
+ *
+ * Policy used by the C entry points: comparison goes through
+ * the Compare and Key function pointers of the GenAVLTree.
+ *
+ ***************************************************************/
+#if defined(USE_GENAVL_PREFIX)
+struct prefixed_key {
+  const void* key;
+  uint64_t prefix;
+};
+
+struct c_policy : entry_policy {
+  typedef prefixed_key key_type;
+
+  explicit c_policy(GenAVLTree* t) : entry_policy(t) {}
+
+  /* The key handle for a key passed in by the caller */
+  key_type make_key(const void* k) const {
+    key_type pk = {k, k && gatp->Prefix ? gatp->Prefix(k) : 0};
+    return pk;
+  }
+  key_type key(node_ptr n) const { return make_key(gatp->Key(n)); }
+  int compare(node_ptr n, const key_type& k) const {
+    if (n->prefix != k.prefix)
+      return n->prefix < k.prefix ? -1 : 1;
+    return gatp->Compare(n, k.key);
+  }
+};
+#else
+struct c_policy : entry_policy {
+  typedef const void* key_type;
+
+  explicit c_policy(GenAVLTree* t) : entry_policy(t) {}
+
+  /* The key handle for a key passed in by the caller */
+  key_type make_key(const void* k) const { return k; }
+  key_type key(node_ptr n) const { return gatp->Key(n); }
+  int compare(node_ptr n, key_type k) const { return gatp->Compare(n, k); }
+};
+#endif
+
+/**************************************************
+ * Sets the referenced child to be either the left
+ * or right child of the given entry. Used
+ * internally to make implementation simpler.
+ **************************************************/
+template <class P>
+inline void set(P& p,
+                typename P::node_ptr gaep,
+                int dir,
+                typename P::node_ptr gaepnext) {
+  if (gaep) {
+    if (dir < 0)
+      p.set_left(gaep, gaepnext);
+    else
+      p.set_right(gaep, gaepnext);
+  } else
+    p.set_root(gaepnext);
+}
+
+/**************************************************
+ * Returns a pointer to the specified entry
+ * given via a pointer to the parent and a
+ * direction. Used internally to make the
+ * implementation simpler.
+ **************************************************/
+template <class P>
+inline typename P::node_ptr val(P& p, typename P::node_ptr gaep, int dir) {
+  if (gaep)
+    return dir < 0 ? p.left(gaep) : p.right(gaep);
+  else
+    return p.root();
+}
+
+/***************************************************************
+ *
+ * A policy whose root is a local subtree root rather than the
+ * tree's, so the algorithms can be run on pieces of a tree.
+ *
+ ***************************************************************/
+template <class P>
+struct sub_policy : P {
+  typename P::node_ptr sub;
+
+  sub_policy(const P& p, typename P::node_ptr r) : P(p), sub(r) {}
+
+  typename P::node_ptr root() const { return sub; }
+  void set_root(typename P::node_ptr n) { sub = n; }
+};
+
+/***********************************************************
+ *
+ * Shift the children of the given entry from left to right
+ * where the imbalance extends one additional level.
+ *
+ ***********************************************************/
+template <class P>
+void shiftdblright(P& p, typename P::node_ptr gaep, int dir) {
+  typename P::node_ptr gaepnext;
+  typename P::node_ptr gaepnextl;
+  typename P::node_ptr gaepnextr;
+
+  gaepnext = val(p, gaep, dir);
+  gaepnextl = p.left(gaepnext);
+  gaepnextr = p.right(gaepnextl);
+
+  p.set_right(gaepnextl, p.left(gaepnextr));
+  p.set_left(gaepnext, p.right(gaepnextr));
+  p.set_left(gaepnextr, gaepnextl);
+  p.set_right(gaepnextr, gaepnext);
+
+  if (p.balance(gaepnextr) == -1) {
+    p.set_balance(gaepnextl, 0);
+    p.set_balance(gaepnext, 1);
+  } else {
+    if (p.balance(gaepnextr) == 1) {
+      p.set_balance(gaepnextl, -1);
+      p.set_balance(gaepnext, 0);
+    } else {
+      p.set_balance(gaepnextl, 0);
+      p.set_balance(gaepnext, 0);
+    }
+  }
+  p.set_balance(gaepnextr, 0);
+  p.fix(gaepnextl);
+  p.fix(gaepnext);
+  p.fix(gaepnextr);
+  set(p, gaep, dir, gaepnextr);
+}
+
+/***********************************************************
+ *
+ * Shift the children of the given entry from left to right
+ * where the imbalance is only a single level.
+ *
+ ***********************************************************/
+template <class P>
+void shiftright(P& p, typename P::node_ptr gaep, int dir) {
+  typename P::node_ptr gaepnext;
+  typename P::node_ptr gaepnextl;
+
+  gaepnext = val(p, gaep, dir);
+  gaepnextl = p.left(gaepnext);
+
+  p.set_left(gaepnext, p.right(gaepnextl));
+  p.set_right(gaepnextl, gaepnext);
+  p.fix(gaepnext);
+  p.fix(gaepnextl);
+  set(p, gaep, dir, gaepnextl);
+
+  if (p.balance(gaepnextl) == -1) {
+    p.set_balance(gaepnextl, 0);
+    p.set_balance(gaepnext, 0);
+  } else {
+    p.set_balance(gaepnextl, 1);
+    p.set_balance(gaepnext, -1);
+  }
+}
+
+/***********************************************************
+ *
+ * Shift the children of the given entry from right to left
+ * where the imbalance is two levels deep.
+ *
+ ***********************************************************/
+template <class P>
+void shiftdblleft(P& p, typename P::node_ptr gaep, int dir) {
+  typename P::node_ptr gaepnext;
+  typename P::node_ptr gaepnextl;
+  typename P::node_ptr gaepnextr;
+
+  gaepnext = val(p, gaep, dir);
+  gaepnextr = p.right(gaepnext);
+  gaepnextl = p.left(gaepnextr);
+
+  p.set_right(gaepnext, p.left(gaepnextl));
+  p.set_left(gaepnextr, p.right(gaepnextl));
+  p.set_left(gaepnextl, gaepnext);
+  p.set_right(gaepnextl, gaepnextr);
+
+  if (p.balance(gaepnextl) == -1) {
+    p.set_balance(gaepnext, 0);
+    p.set_balance(gaepnextr, 1);
+  } else {
+    if (p.balance(gaepnextl) == 1) {
+      p.set_balance(gaepnext, -1);
+      p.set_balance(gaepnextr, 0);
+    } else {
+      p.set_balance(gaepnext, 0);
+      p.set_balance(gaepnextr, 0);
+    }
+  }
+  p.set_balance(gaepnextl, 0);
+  p.fix(gaepnext);
+  p.fix(gaepnextr);
+  p.fix(gaepnextl);
+  set(p, gaep, dir, gaepnextl);
+}
+
+/***********************************************************
+ *
+ * Shift the children of the given entry from right to left
+ * where the imbalance is only a single level.
+ *
+ ***********************************************************/
+template <class P>
+void shiftleft(P& p, typename P::node_ptr gaep, int dir) {
+  typename P::node_ptr gaepnext;
+  typename P::node_ptr gaepnextr;
+
+  gaepnext = val(p, gaep, dir);
+  gaepnextr = p.right(gaepnext);
+
+  p.set_right(gaepnext, p.left(gaepnextr));
+  p.set_left(gaepnextr, gaepnext);
+  p.fix(gaepnext);
+  p.fix(gaepnextr);
+  set(p, gaep, dir, gaepnextr);
+
+  if (p.balance(gaepnextr) == 1) {
+    p.set_balance(gaepnextr, 0);
+    p.set_balance(gaepnext, 0);
+  } else {
+    p.set_balance(gaepnextr, -1);
+    p.set_balance(gaepnext, 1);
+  }
+}
+
+/*******************************************************
+ *
+ * Find and return a pointer to the entry given by the
+ * key data. Return 0 if no such entry is in the tree.
+ *
+ *******************************************************/
+template <class P, class K>
+typename P::node_ptr find(P& p, const K& key) {
+  typename P::node_ptr gaep;
+  int dir;
+
+  for (gaep = p.root(); gaep;) {
+    if ((dir = p.compare(gaep, key)) > 0)
+      gaep = p.left(gaep);
+    else {
+      if (dir < 0)
+        gaep = p.right(gaep);
+      else
+        return gaep;
+    }
+  }
+
+  return 0;
+}
+
+/*******************************************************
+ *
+ * Find and return a pointer to the first entry in the
+ * tree based on lexicographical order.
+ *
+ *******************************************************/
+template <class P>
+typename P::node_ptr first(P& p) {
+  typename P::node_ptr gaep;
+  typename P::node_ptr first;
+
+  for (first = 0, gaep = p.root(); gaep;) {
+    first = gaep;
+    gaep = p.left(gaep);
+  }
+
+  return first;
+}
+
+/*******************************************************
+ *
+ * Return a pointer to the entry which is next
+ * (lexicographically) to the given key. Return 0 if
+ * there is no such entry.
+ *
+ *******************************************************/
+template <class P, class K>
+typename P::node_ptr next(P& p, const K& key) {
+  typename P::node_ptr gaep;
+  typename P::node_ptr next;
+
+  for (next = 0, gaep = p.root(); gaep;) {
+    if (p.compare(gaep, key) > 0) {
+      next = gaep;
+      gaep = p.left(gaep);
+    } else {
+      gaep = p.right(gaep);
+    }
+  }
+
+  return next;
+}
+
+/*******************************************************
+ *
+ * Return a pointer to the entry which is either equal
+ * to the given key or next (lexicographically) to the
+ * given key. Return 0 if there is no such entry.
+ *
+ *******************************************************/
+template <class P, class K>
+typename P::node_ptr equal_next(P& p, const K& key) {
+  typename P::node_ptr gaep;
+  typename P::node_ptr next;
+  int dir;
+
+  for (next = 0, gaep = p.root(); gaep;) {
+    if ((dir = p.compare(gaep, key)) > 0) {
+      next = gaep;
+      gaep = p.left(gaep);
+    } else {
+      if (dir < 0)
+        gaep = p.right(gaep);
+      else
+        return gaep;
+    }
+  }
+
+  return next;
+}
+
+/*******************************************************
+ *
+ * Return a pointer to the entry which is previous
+ * (lexicographically) to the given key. Return 0 if
+ * there is no such entry.
+ *
+ *******************************************************/
+template <class P, class K>
+typename P::node_ptr prev(P& p, const K& key) {
+  typename P::node_ptr gaep;
+  typename P::node_ptr prev;
+
+  for (prev = 0, gaep = p.root(); gaep;) {
+    if (p.compare(gaep, key) < 0) {
+      prev = gaep;
+      gaep = p.right(gaep);
+    } else {
+      gaep = p.left(gaep);
+    }
+  }
+
+  return prev;
+}
+
+/*******************************************************
+ *
+ * Return a pointer to the entry which is either equal
+ * to the given key or previous (lexicographically) to
+ * the given key. Return 0 if there is no such entry.
+ *
+ *******************************************************/
+template <class P, class K>
+typename P::node_ptr equal_prev(P& p, const K& key) {
+  typename P::node_ptr gaep;
+  typename P::node_ptr prev;
+  int dir;
+
+  for (prev = 0, gaep = p.root(); gaep;) {
+    if ((dir = p.compare(gaep, key)) < 0) {
+      prev = gaep;
+      gaep = p.right(gaep);
+    } else {
+      if (dir > 0)
+        gaep = p.left(gaep);
+      else
+        return gaep;
+    }
+  }
+
+  return prev;
+}
+
+/*******************************************************
+ *
+ * Add the given entry to the tree without balancing.
+ * If there exists an entry with the same key already
+ * in the tree, return 0. Otherwise return 1.
+ *
+ * The tree may be deeper than MAX_GENAVL_STACK, so no
+ * fixed path is kept. Counts alone are raised on a
+ * second descent. With USE_GENAVL_AUGMENT, an Augment
+ * is applied bottom up through the parent links or,
+ * without them, a path kept on the heap, and if that
+ * cannot be had -1 is returned with nothing changed.
+ *
+ *******************************************************/
+template <class P>
+int add_unbal(P& p, typename P::node_ptr gae) {
+  typename P::node_ptr gaep = 0;
+  typename P::node_ptr gaepnext;
+  typename P::key_type key = p.key(gae);
+  int dir = 0;
+#if defined(USE_GENAVL_AUGMENT)
+  bool augmented = p.augmented();
+#if !defined(USE_GENAVL_PARENT)
+  path_buffer<typename P::node_ptr> path;
+#endif
+#endif
+
+  /* Initialize the left and right ptrs   */
+  p.init(gae);
+
+  /* Find the insertion point             */
+  for (gaepnext = p.root(); gaepnext;) {
+    gaep = gaepnext;
+#if defined(USE_GENAVL_AUGMENT) && !defined(USE_GENAVL_PARENT)
+    if (augmented && !path.push(gaep))
+      return -1;
+#endif
+    if ((dir = p.compare(gaepnext, key)) > 0)
+      gaepnext = p.left(gaepnext);
+    else {
+      if (dir < 0)
+        gaepnext = p.right(gaepnext);
+      else
+        /* Entry already exists */
+        return 0;
+    }
+  }
+
+  /* Insert the new entry */
+  set(p, gaep, 0 - dir, gae);
+
+#if defined(USE_GENAVL_AUGMENT)
+  if (augmented) {
+    p.fix(gae);
+#if defined(USE_GENAVL_PARENT)
+    for (gaep = p.parent(gae); gaep; gaep = p.parent(gaep))
+      p.fix(gaep);
+#else
+    while (!path.empty())
+      p.fix(path.pop());
+#endif
+    return 1;
+  }
+#endif
+
+#if defined(USE_GENAVL_COUNT)
+  /* Only the counts need keeping: each entry on the
+   * way down gains one */
+  for (gaepnext = p.root(); gaepnext != gae;) {
+    p.grow(gaepnext);
+    gaepnext = p.compare(gaepnext, key) > 0 ? p.left(gaepnext)
+                                            : p.right(gaepnext);
+  }
+#endif
+
+  return 1;
+}
+
+/*******************************************************
+ *
+ * Add the given entry to the tree. If there exists an
+ * entry with the same key already in the tree, return
+ * 0. Otherwise return 1.
+ *
+ * This function performs an AVL tree insertion with
+ * balancing. The key of the new entry is fetched once
+ * and compared against each node on the way down, in
+ * the same way that find does. The direction taken at
+ * each level is recorded on the stack so that the
+ * rebalance walk makes no further comparisons.
+ *
+ *******************************************************/
+template <class P>
+void add_at(P& p,
+            typename P::node_ptr gae,
+            stack_entry<typename P::node_ptr>* stack,
+            int sp);
+
+template <class P>
+int add(P& p, typename P::node_ptr gae) {
+  typedef typename P::node_ptr node_ptr;
+  stack_entry<node_ptr> stack[MAX_GENAVL_STACK];
+  node_ptr gaepnext;
+  typename P::key_type key = p.key(gae);
+  int sp = 0;
+  int dir;
+
+  /* Find the insertion point */
+  for (gaepnext = p.root(); gaepnext; sp++) {
+    if ((dir = 0 - p.compare(gaepnext, key)) == 0)
+      /* Entry already exists */
+      return 0;
+    stack[sp].e = gaepnext;
+    stack[sp].d = dir < 0 ? -1 : 1;
+    gaepnext = dir < 0 ? p.left(gaepnext) : p.right(gaepnext);
+  }
+
+  add_at(p, gae, stack, sp);
+  return 1;
+}
+
+/***********************************************************
+ *
+ * Add the entry as the new last entry of the tree, which
+ * takes one comparison. Return 1 if it was added, 0 if the
+ * last entry has the same key and -1 if its key is not
+ * past the last, in which case nothing is changed.
+ *
+ ***********************************************************/
+template <class P>
+int add_last(P& p, typename P::node_ptr gae) {
+  typedef typename P::node_ptr node_ptr;
+  stack_entry<node_ptr> stack[MAX_GENAVL_STACK];
+  node_ptr gaepnext;
+  int sp = 0;
+  int dir;
+
+  for (gaepnext = p.root(); gaepnext; gaepnext = p.right(gaepnext)) {
+    stack[sp].e = gaepnext;
+    stack[sp++].d = 1;
+  }
+  if (sp && (dir = p.compare(stack[sp - 1].e, p.key(gae))) >= 0)
+    return dir ? -1 : 0;
+
+  add_at(p, gae, stack, sp);
+  return 1;
+}
+
+/***********************************************************
+ *
+ * Link the new entry in below the path in the stack,
+ * which runs from the root down to its parent with the
+ * side taken from each entry, and rebalance.
+ *
+ ***********************************************************/
+template <class P>
+void add_at(P& p,
+            typename P::node_ptr gae,
+            stack_entry<typename P::node_ptr>* stack,
+            int sp) {
+  typename P::node_ptr gaep;
+  typename P::node_ptr balgaep;
+  int baldir;
+  int bal;
+  int i;
+
+  /* Initialize the left and right ptrs   */
+  p.init(gae);
+
+  /* Insert the new entry */
+  if (sp)
+    set(p, stack[sp - 1].e, stack[sp - 1].d, gae);
+  else
+    p.set_root(gae);
+  p.fix(gae);
+  for (i = sp; i--;)
+    p.fix(stack[i].e);
+
+  /* The balance point is the deepest entry on the path */
+  /* which was already out of balance, else the root    */
+  for (bal = sp - 1; bal > 0 && !p.balance(stack[bal].e); bal--)
+    ;
+  if (bal < 0)
+    return;
+  for (i = bal; i < sp; i++)
+    p.set_balance(stack[i].e, p.balance(stack[i].e) + stack[i].d);
+
+  /* Shift to restore proper balance if needed */
+  gaep = stack[bal].e;
+  balgaep = bal ? stack[bal - 1].e : 0;
+  baldir = bal ? stack[bal - 1].d : 0;
+  if (p.balance(gaep) == 2) {
+    if (p.balance(p.right(gaep)) == 1)
+      shiftleft(p, balgaep, baldir);
+    else if (p.balance(p.right(gaep)) == -1)
+      shiftdblleft(p, balgaep, baldir);
+  } else if (p.balance(gaep) == -2) {
+    if (p.balance(p.left(gaep)) == -1)
+      shiftright(p, balgaep, baldir);
+    else if (p.balance(p.left(gaep)) == 1)
+      shiftdblright(p, balgaep, baldir);
+  }
+}
+
+#if defined(USE_GENAVL_PARENT)
+/***********************************************************
+ *
+ * Finger search. Starting from an entry near the key,
+ * climb the parent links until an entry is found with the
+ * key known to belong in its subtree on side *dirp. Along
+ * the way, only the entries where the climb turns are
+ * compared, so keys d entries apart cost O(log d)
+ * comparisons. If an entry equal to the key is met it is
+ * returned with *dirp set to 0. *nextp is set to the
+ * least entry known to be greater than the key, or 0.
+ *
+ ***********************************************************/
+template <class P, class K>
+typename P::node_ptr finger(P& p,
+                            typename P::node_ptr gaep,
+                            const K& key,
+                            int* dirp,
+                            typename P::node_ptr* nextp) {
+  typename P::node_ptr gaepnext;
+  typename P::node_ptr gaepparent;
+  int dir;
+
+  *nextp = 0;
+  if ((*dirp = 0 - p.compare(gaep, key)) == 0)
+    return gaep;
+
+  if (*dirp > 0) {
+    /* The key is past gaep, so it belongs to the right */
+    /* of gaep unless it is past the first entry above  */
+    /* with gaep on its left                            */
+    *dirp = 1;
+    for (;;) {
+      for (gaepnext = gaep;
+           (gaepparent = p.parent(gaepnext)) && p.right(gaepparent) == gaepnext;
+           gaepnext = gaepparent)
+        ;
+      if (!gaepparent || (dir = p.compare(gaepparent, key)) > 0)
+        break;
+      gaep = gaepparent;
+      if (dir == 0) {
+        *dirp = 0;
+        break;
+      }
+    }
+    *nextp = gaepparent;
+  } else {
+    /* Likewise to the left                             */
+    *dirp = -1;
+    for (;;) {
+      for (gaepnext = gaep;
+           (gaepparent = p.parent(gaepnext)) && p.left(gaepparent) == gaepnext;
+           gaepnext = gaepparent)
+        ;
+      if (!gaepparent || (dir = p.compare(gaepparent, key)) < 0)
+        break;
+      gaep = gaepparent;
+      if (dir == 0) {
+        *dirp = 0;
+        break;
+      }
+    }
+    *nextp = gaep;
+  }
+  return gaep;
+}
+
+/***********************************************************
+ *
+ * Return the entry equal to the key, searching from the
+ * entry hint which must be in the tree
+ *
+ ***********************************************************/
+template <class P, class K>
+typename P::node_ptr find_near(P& p,
+                               const K& key,
+                               typename P::node_ptr hint) {
+  typename P::node_ptr gaep;
+  typename P::node_ptr next;
+  int dir;
+
+  gaep = finger(p, hint, key, &dir, &next);
+  if (dir == 0)
+    return gaep;
+  sub_policy<P> sp(p, dir < 0 ? p.left(gaep) : p.right(gaep));
+  return find(sp, key);
+}
+
+/***********************************************************
+ *
+ * Return the least entry greater than or equal to the
+ * key, searching from the entry hint which must be in
+ * the tree
+ *
+ ***********************************************************/
+template <class P, class K>
+typename P::node_ptr equal_next_near(P& p,
+                                     const K& key,
+                                     typename P::node_ptr hint) {
+  typename P::node_ptr gaep;
+  typename P::node_ptr next;
+  int dir;
+
+  gaep = finger(p, hint, key, &dir, &next);
+  if (dir == 0)
+    return gaep;
+  sub_policy<P> sp(p, dir < 0 ? p.left(gaep) : p.right(gaep));
+  gaep = equal_next(sp, key);
+  return gaep ? gaep : next;
+}
+
+/***********************************************************
+ *
+ * Add the entry, searching for its place from the entry
+ * hint which must be in the tree. Return 1 if added, 0 if
+ * an entry with the same key is already there.
+ *
+ ***********************************************************/
+template <class P>
+int add_near(P& p, typename P::node_ptr gae, typename P::node_ptr hint) {
+  typedef typename P::node_ptr node_ptr;
+  stack_entry<node_ptr> stack[MAX_GENAVL_STACK];
+  typename P::key_type key = p.key(gae);
+  node_ptr gaep;
+  node_ptr gaepnext;
+  node_ptr next;
+  int depth = 0;
+  int sp;
+  int dir;
+
+  gaep = finger(p, hint, key, &dir, &next);
+  if (dir == 0)
+    return 0;
+
+  /* Fill in the path down to gaep from its parents     */
+  for (gaepnext = gaep; p.parent(gaepnext); gaepnext = p.parent(gaepnext))
+    depth++;
+  stack[depth].e = gaep;
+  stack[depth].d = dir;
+  for (gaepnext = gaep, sp = depth; sp; sp--) {
+    node_ptr gaepparent = p.parent(gaepnext);
+
+    stack[sp - 1].e = gaepparent;
+    stack[sp - 1].d = p.left(gaepparent) == gaepnext ? -1 : 1;
+    gaepnext = gaepparent;
+  }
+
+  /* And search on down from there                      */
+  sp = depth + 1;
+  for (gaepnext = dir < 0 ? p.left(gaep) : p.right(gaep); gaepnext; sp++) {
+    if ((dir = 0 - p.compare(gaepnext, key)) == 0)
+      return 0;
+    stack[sp].e = gaepnext;
+    stack[sp].d = dir < 0 ? -1 : 1;
+    gaepnext = dir < 0 ? p.left(gaepnext) : p.right(gaepnext);
+  }
+
+  add_at(p, gae, stack, sp);
+  return 1;
+}
+#endif
+
+/*******************************************************
+ *
+ * Link n entries, supplied in ascending key order by
+ * next(), into a perfectly balanced subtree and return
+ * its root. The height of the subtree is returned
+ * through height. The left subtree of every node gets
+ * the smaller half so each balance is 0 or 1. No
+ * comparisons are made and the recursion is only as
+ * deep as the resulting tree.
+ *
+ *******************************************************/
+template <class P, class Next>
+typename P::node_ptr build(P& p, size_t n, Next& next, int* height) {
+  typename P::node_ptr gaep;
+  typename P::node_ptr gaepl;
+  typename P::node_ptr gaepr;
+  int hl;
+  int hr;
+
+  if (n == 0) {
+    *height = 0;
+    return 0;
+  }
+
+  gaepl = build(p, (n - 1) / 2, next, &hl);
+  gaep = next();
+  p.init(gaep);
+  gaepr = build(p, n - 1 - (n - 1) / 2, next, &hr);
+
+  p.set_left(gaep, gaepl);
+  p.set_right(gaep, gaepr);
+  p.set_balance(gaep, hr - hl);
+  p.fix(gaep);
+  *height = 1 + (hr > hl ? hr : hl);
+  return gaep;
+}
+
+/*******************************************************
+ *
+ * Replace the contents of the tree with a balanced
+ * tree built from n entries in ascending key order.
+ *
+ *******************************************************/
+template <class P, class Next>
+void build_sorted(P& p, size_t n, Next& next) {
+  int height;
+
+  p.set_root(build(p, n, next, &height));
+}
+
+/*******************************************************
+ *
+ * Return the height of the subtree, found by following
+ * the taller child at each level.
+ *
+ *******************************************************/
+template <class P>
+int height(P& p, typename P::node_ptr gaep) {
+  int h;
+
+  for (h = 0; gaep; h++)
+    gaep = p.balance(gaep) < 0 ? p.left(gaep) : p.right(gaep);
+  return h;
+}
+
+/*******************************************************
+ *
+ * Orders two entries by key for sorting a batch
+ *
+ *******************************************************/
+template <class P>
+struct entry_less {
+  P* p;
+
+  explicit entry_less(P* pp) : p(pp) {}
+
+  bool operator()(typename P::node_ptr a, typename P::node_ptr b) const {
+    return p->compare(a, p->key(b)) < 0;
+  }
+};
+
+/*******************************************************
+ *
+ * Hands out the entries of a list linked through the
+ * right pointers, for feeding build
+ *
+ *******************************************************/
+template <class P>
+struct list_source {
+  P* p;
+  typename P::node_ptr e;
+
+  list_source(P* pp, typename P::node_ptr head) : p(pp), e(head) {}
+
+  typename P::node_ptr operator()() {
+    typename P::node_ptr r = e;
+
+    e = p->right(r);
+    return r;
+  }
+};
+
+/*******************************************************
+ *
+ * Unlink every entry of the tree into a list in key
+ * order, linked through the right pointers. Returns the
+ * head of the list and the number of entries through
+ * count. The tree is left empty.
+ *
+ *******************************************************/
+template <class P>
+typename P::node_ptr flatten(P& p, size_t* count) {
+  typename P::node_ptr stack[MAX_GENAVL_STACK];
+  typename P::node_ptr head = 0;
+  typename P::node_ptr tail = 0;
+  typename P::node_ptr gaep;
+  int sp = 0;
+
+  *count = 0;
+  for (gaep = p.root(); gaep; gaep = p.left(gaep))
+    stack[sp++] = gaep;
+  while (sp) {
+    /* The right link of the previous entry has      */
+    /* already been followed, so it can be reused    */
+    gaep = stack[--sp];
+    if (tail)
+      p.set_right(tail, gaep);
+    else
+      head = gaep;
+    tail = gaep;
+    (*count)++;
+    for (gaep = p.right(gaep); gaep; gaep = p.left(gaep))
+      stack[sp++] = gaep;
+  }
+  if (tail)
+    p.set_right(tail, 0);
+  p.set_root(0);
+  return head;
+}
+
+#if defined(USE_GENAVL_COUNT)
+/*******************************************************
+ *
+ * Return the number of entries whose keys are less
+ * than the key, or less than or equal to it if
+ * inclusive is set
+ *
+ *******************************************************/
+template <class P, class K>
+size_t rank(P& p, const K& key, int inclusive) {
+  typename P::node_ptr gaep;
+  size_t r = 0;
+  int dir;
+
+  for (gaep = p.root(); gaep;) {
+    dir = p.compare(gaep, key);
+    if (dir < 0 || (dir == 0 && inclusive)) {
+      r += p.count(p.left(gaep)) + 1;
+      gaep = p.right(gaep);
+    } else
+      gaep = p.left(gaep);
+  }
+  return r;
+}
+
+/*******************************************************
+ *
+ * Return the entry with the given zero-based position
+ * in key order, or 0 if there are not that many
+ *
+ *******************************************************/
+template <class P>
+typename P::node_ptr select(P& p, size_t i) {
+  typename P::node_ptr gaep;
+  size_t nl;
+
+  for (gaep = p.root(); gaep;) {
+    nl = p.count(p.left(gaep));
+    if (i < nl)
+      gaep = p.left(gaep);
+    else if (i == nl)
+      return gaep;
+    else {
+      i -= nl + 1;
+      gaep = p.right(gaep);
+    }
+  }
+  return 0;
+}
+#endif
+
+/*******************************************************
+ *
+ * Fold the entries with keys from lo to hi inclusive
+ * into fold, in key order. A null bound is open. Whole
+ * subtrees inside the range are folded as one, with
+ * subtree set, so only the two boundary paths below the
+ * node where they part are walked.
+ *
+ *******************************************************/
+template <class P, class K, class Fold>
+void aggregate_range(P& p, const K* lo, const K* hi, Fold& fold) {
+  typename P::node_ptr stack[2 * MAX_GENAVL_STACK];
+  typename P::node_ptr gaep;
+  int subtree[2 * MAX_GENAVL_STACK];
+  int sp = 0;
+
+  /* Find the node where the paths to lo and hi part */
+  for (gaep = p.root(); gaep;) {
+    if (lo && p.compare(gaep, *lo) < 0)
+      gaep = p.right(gaep);
+    else if (hi && p.compare(gaep, *hi) > 0)
+      gaep = p.left(gaep);
+    else
+      break;
+  }
+  if (!gaep)
+    return;
+
+  /* The left path is walked from the top down, which */
+  /* is backwards, so stack the pieces and fold them  */
+  /* after                                            */
+  for (typename P::node_ptr gaepl = p.left(gaep); gaepl;) {
+    if (lo && p.compare(gaepl, *lo) < 0)
+      gaepl = p.right(gaepl);
+    else {
+      if (p.right(gaepl)) {
+        stack[sp] = p.right(gaepl);
+        subtree[sp++] = 1;
+      }
+      stack[sp] = gaepl;
+      subtree[sp++] = 0;
+      gaepl = p.left(gaepl);
+    }
+  }
+  while (sp) {
+    sp--;
+    fold(stack[sp], subtree[sp]);
+  }
+
+  fold(gaep, 0);
+
+  for (typename P::node_ptr gaepr = p.right(gaep); gaepr;) {
+    if (hi && p.compare(gaepr, *hi) > 0)
+      gaepr = p.left(gaepr);
+    else {
+      if (p.left(gaepr))
+        fold(p.left(gaepr), 1);
+      fold(gaepr, 0);
+      gaepr = p.right(gaepr);
+    }
+  }
+}
+
+/*******************************************************
+ *
+ * Recompute the per-node values along the path to the
+ * entry with the given key. Returns 0 if there is no
+ * such entry.
+ *
+ *******************************************************/
+template <class P, class K>
+int fix_path(P& p, const K& key) {
+  typename P::node_ptr stack[MAX_GENAVL_STACK];
+  typename P::node_ptr gaep;
+  int sp = 0;
+  int dir;
+
+  for (gaep = p.root(); gaep;) {
+    stack[sp++] = gaep;
+    if ((dir = p.compare(gaep, key)) > 0)
+      gaep = p.left(gaep);
+    else if (dir < 0)
+      gaep = p.right(gaep);
+    else
+      break;
+  }
+  if (!gaep)
+    return 0;
+  while (sp)
+    p.fix(stack[--sp]);
+  return 1;
+}
+
+/***************************************************************
+ *
+ * Join and split
+ *
+ * These operate on detached subtrees given by their roots and
+ * return the root of the result. The rotations run through a
+ * sub_policy, so they can be used on pieces of a tree.
+ *
+ ***************************************************************/
+
+/*******************************************************
+ *
+ * Join where the left subtree is the taller. Walk down
+ * the right spine of the left subtree to a node no more
+ * than one level taller than the right subtree, hang
+ * the middle entry there and rebalance on the way back
+ * up the spine, as an insertion would.
+ *
+ *******************************************************/
+template <class P>
+typename P::node_ptr join_right(P& p,
+                                typename P::node_ptr gaepl,
+                                typename P::node_ptr gae,
+                                typename P::node_ptr gaepr,
+                                int hl,
+                                int hr) {
+  typedef typename P::node_ptr node_ptr;
+  sub_policy<P> sp(p, gaepl);
+  node_ptr path[MAX_GENAVL_STACK];
+  node_ptr gaep;
+  int sp_top = 0;
+  int h = hl;
+
+  for (gaep = gaepl; h > hr + 1; gaep = sp.right(gaep)) {
+    path[sp_top++] = gaep;
+    h -= sp.balance(gaep) < 0 ? 2 : 1;
+  }
+
+  sp.init(gae);
+  sp.set_left(gae, gaep);
+  sp.set_right(gae, gaepr);
+  sp.set_balance(gae, hr - h);
+  sp.fix(gae);
+  sp.set_right(path[sp_top - 1], gae);
+  for (int i = sp_top; i--;)
+    sp.fix(path[i]);
+
+  /* The right subtree of each node on the spine may */
+  /* have grown by one level                         */
+  while (sp_top--) {
+    node_ptr gaepparent = sp_top ? path[sp_top - 1] : 0;
+
+    gaep = path[sp_top];
+    if (sp.balance(gaep) == -1) {
+      sp.set_balance(gaep, 0);
+      break;
+    }
+    if (sp.balance(gaep) == 0) {
+      sp.set_balance(gaep, 1);
+      continue;
+    }
+    sp.set_balance(gaep, 2);
+    if (sp.balance(sp.right(gaep)) == -1) {
+      shiftdblleft(sp, gaepparent, 1);
+      break;
+    }
+    if (sp.balance(sp.right(gaep)) == 1) {
+      shiftleft(sp, gaepparent, 1);
+      break;
+    }
+    /* Single shift over a level child grows by one */
+    shiftleft(sp, gaepparent, 1);
+  }
+  return sp.sub;
+}
+
+/*******************************************************
+ *
+ * Join where the right subtree is the taller, the
+ * mirror image of join_right.
+ *
+ *******************************************************/
+template <class P>
+typename P::node_ptr join_left(P& p,
+                               typename P::node_ptr gaepl,
+                               typename P::node_ptr gae,
+                               typename P::node_ptr gaepr,
+                               int hl,
+                               int hr) {
+  typedef typename P::node_ptr node_ptr;
+  sub_policy<P> sp(p, gaepr);
+  node_ptr path[MAX_GENAVL_STACK];
+  node_ptr gaep;
+  int sp_top = 0;
+  int h = hr;
+
+  for (gaep = gaepr; h > hl + 1; gaep = sp.left(gaep)) {
+    path[sp_top++] = gaep;
+    h -= sp.balance(gaep) > 0 ? 2 : 1;
+  }
+
+  sp.init(gae);
+  sp.set_left(gae, gaepl);
+  sp.set_right(gae, gaep);
+  sp.set_balance(gae, h - hl);
+  sp.fix(gae);
+  sp.set_left(path[sp_top - 1], gae);
+  for (int i = sp_top; i--;)
+    sp.fix(path[i]);
+
+  /* The left subtree of each node on the spine may  */
+  /* have grown by one level                         */
+  while (sp_top--) {
+    node_ptr gaepparent = sp_top ? path[sp_top - 1] : 0;
+
+    gaep = path[sp_top];
+    if (sp.balance(gaep) == 1) {
+      sp.set_balance(gaep, 0);
+      break;
+    }
+    if (sp.balance(gaep) == 0) {
+      sp.set_balance(gaep, -1);
+      continue;
+    }
+    sp.set_balance(gaep, -2);
+    if (sp.balance(sp.left(gaep)) == 1) {
+      shiftdblright(sp, gaepparent, -1);
+      break;
+    }
+    if (sp.balance(sp.left(gaep)) == -1) {
+      shiftright(sp, gaepparent, -1);
+      break;
+    }
+    shiftright(sp, gaepparent, -1);
+  }
+  return sp.sub;
+}
+
+/*******************************************************
+ *
+ * Join two subtrees and a middle entry, where every key
+ * in the left subtree is less than the middle entry's
+ * and every key in the right subtree is greater, into a
+ * single balanced subtree. Costs time proportional to
+ * the difference in height of the two subtrees.
+ *
+ *******************************************************/
+template <class P>
+typename P::node_ptr join(P& p,
+                          typename P::node_ptr gaepl,
+                          typename P::node_ptr gae,
+                          typename P::node_ptr gaepr) {
+  int hl = height(p, gaepl);
+  int hr = height(p, gaepr);
+
+  if (hl > hr + 1)
+    return join_right(p, gaepl, gae, gaepr, hl, hr);
+  if (hr > hl + 1)
+    return join_left(p, gaepl, gae, gaepr, hl, hr);
+
+  p.init(gae);
+  p.set_left(gae, gaepl);
+  p.set_right(gae, gaepr);
+  p.set_balance(gae, hr - hl);
+  p.fix(gae);
+  return gae;
+}
+
+/*******************************************************
+ *
+ * Remove the last entry of the subtree, returned
+ * through last, and return the remaining subtree
+ *
+ *******************************************************/
+template <class P>
+typename P::node_ptr split_last(P& p,
+                                typename P::node_ptr gaep,
+                                typename P::node_ptr* last) {
+  typename P::node_ptr gaepl = p.left(gaep);
+  typename P::node_ptr gaepr = p.right(gaep);
+
+  if (!gaepr) {
+    *last = gaep;
+    return gaepl;
+  }
+  return join(p, gaepl, gaep, split_last(p, gaepr, last));
+}
+
+/*******************************************************
+ *
+ * Join two subtrees, where every key in the left is
+ * less than every key in the right, without a middle
+ * entry
+ *
+ *******************************************************/
+template <class P>
+typename P::node_ptr join2(P& p,
+                           typename P::node_ptr gaepl,
+                           typename P::node_ptr gaepr) {
+  typename P::node_ptr last;
+
+  if (!gaepl)
+    return gaepr;
+  if (!gaepr)
+    return gaepl;
+  gaepl = split_last(p, gaepl, &last);
+  return join(p, gaepl, last, gaepr);
+}
+
+/*******************************************************
+ *
+ * Split the subtree into the entries less than the key,
+ * returned through left, and those greater, returned
+ * through right. The entry equal to the key, if any, is
+ * returned unlinked; otherwise 0 is returned.
+ *
+ *******************************************************/
+template <class P, class K>
+typename P::node_ptr split(P& p,
+                           typename P::node_ptr gaep,
+                           const K& key,
+                           typename P::node_ptr* left,
+                           typename P::node_ptr* right) {
+  typename P::node_ptr gaepl;
+  typename P::node_ptr gaepr;
+  typename P::node_ptr gaepm;
+  typename P::node_ptr gaeps;
+  int dir;
+
+  if (!gaep) {
+    *left = *right = 0;
+    return 0;
+  }
+  gaepl = p.left(gaep);
+  gaepr = p.right(gaep);
+  if ((dir = p.compare(gaep, key)) == 0) {
+    *left = gaepl;
+    *right = gaepr;
+    return gaep;
+  }
+  if (dir > 0) {
+    gaepm = split(p, gaepl, key, left, &gaeps);
+    *right = join(p, gaeps, gaep, gaepr);
+  } else {
+    gaepm = split(p, gaepr, key, &gaeps, right);
+    *left = join(p, gaepl, gaep, gaeps);
+  }
+  return gaepm;
+}
+
+/***************************************************************
+ *
+ * Set operations
+ *
+ * Each divides one tree by the root key of the other and
+ * recurses on the two halves, joining the results, which costs
+ * O(m log(n/m + 1)) comparisons for trees of size m <= n. When
+ * par is positive the two halves of a large enough problem are
+ * run on separate threads, par levels deep.
+ *
+ ***************************************************************/
+#define GENAVL_FORK_HEIGHT 12
+
+/*******************************************************
+ *
+ * Run f and g, f on a new thread if par allows it and
+ * a thread can be had
+ *
+ *******************************************************/
+template <class F, class G>
+void fork2(int par, const F& f, const G& g) {
+  if (par > 0) {
+    std::thread th;
+
+    try {
+      th = std::thread(f);
+    } catch (const std::system_error&) {
+    }
+    if (th.joinable()) {
+      g();
+      th.join();
+      return;
+    }
+  }
+  f();
+  g();
+}
+
+/*******************************************************
+ *
+ * Decide whether a problem is big enough to fork
+ *
+ *******************************************************/
+template <class P>
+int fork_levels(P& p,
+                typename P::node_ptr gaep1,
+                typename P::node_ptr gaep2,
+                int par) {
+  if (par <= 0 || height(p, gaep1) < GENAVL_FORK_HEIGHT ||
+      height(p, gaep2) < GENAVL_FORK_HEIGHT)
+    return 0;
+  return par;
+}
+
+/*******************************************************
+ *
+ * Union of two subtrees. Every entry of the first is
+ * kept and the entries of the second whose keys are
+ * not in the first are added to it. Entries of the
+ * second whose keys are in the first are returned as a
+ * subtree through dups.
+ *
+ *******************************************************/
+template <class P>
+typename P::node_ptr unite(P& p,
+                           typename P::node_ptr gaep1,
+                           typename P::node_ptr gaep2,
+                           typename P::node_ptr* dups,
+                           int par) {
+  typedef typename P::node_ptr node_ptr;
+  node_ptr gaepl1, gaepr1, gaepl2, gaepr2, gaepm;
+  node_ptr gaepl, gaepr, dupl, dupr;
+
+  if (!gaep1 || !gaep2) {
+    *dups = 0;
+    return gaep1 ? gaep1 : gaep2;
+  }
+  par = fork_levels(p, gaep1, gaep2, par);
+  gaepl1 = p.left(gaep1);
+  gaepr1 = p.right(gaep1);
+  gaepm = split(p, gaep2, p.key(gaep1), &gaepl2, &gaepr2);
+  fork2(par,
+        [&] { gaepl = unite(p, gaepl1, gaepl2, &dupl, par - 1); },
+        [&] { gaepr = unite(p, gaepr1, gaepr2, &dupr, par - 1); });
+  *dups = gaepm ? join(p, dupl, gaepm, dupr) : join2(p, dupl, dupr);
+  return join(p, gaepl, gaep1, gaepr);
+}
+
+/*******************************************************
+ *
+ * Intersection of two subtrees. The entries of the
+ * first whose keys are also in the second are kept and
+ * the rest are returned as a subtree through removed.
+ * The second subtree is only read.
+ *
+ *******************************************************/
+template <class P>
+typename P::node_ptr intersect(P& p,
+                               typename P::node_ptr gaep1,
+                               typename P::node_ptr gaep2,
+                               typename P::node_ptr* removed,
+                               int par) {
+  typedef typename P::node_ptr node_ptr;
+  node_ptr gaepl1, gaepr1, gaepm;
+  node_ptr gaepl, gaepr, reml, remr;
+
+  if (!gaep1 || !gaep2) {
+    *removed = gaep1;
+    return 0;
+  }
+  par = fork_levels(p, gaep1, gaep2, par);
+  gaepm = split(p, gaep1, p.key(gaep2), &gaepl1, &gaepr1);
+  fork2(par,
+        [&] { gaepl = intersect(p, gaepl1, p.left(gaep2), &reml, par - 1); },
+        [&] { gaepr = intersect(p, gaepr1, p.right(gaep2), &remr, par - 1); });
+  *removed = join2(p, reml, remr);
+  return gaepm ? join(p, gaepl, gaepm, gaepr) : join2(p, gaepl, gaepr);
+}
+
+/*******************************************************
+ *
+ * Difference of two subtrees. The entries of the first
+ * whose keys are not in the second are kept and the
+ * rest are returned as a subtree through removed. The
+ * second subtree is only read.
+ *
+ *******************************************************/
+template <class P>
+typename P::node_ptr difference(P& p,
+                                typename P::node_ptr gaep1,
+                                typename P::node_ptr gaep2,
+                                typename P::node_ptr* removed,
+                                int par) {
+  typedef typename P::node_ptr node_ptr;
+  node_ptr gaepl1, gaepr1, gaepm;
+  node_ptr gaepl, gaepr, reml, remr;
+
+  if (!gaep1 || !gaep2) {
+    *removed = 0;
+    return gaep1;
+  }
+  par = fork_levels(p, gaep1, gaep2, par);
+  gaepm = split(p, gaep1, p.key(gaep2), &gaepl1, &gaepr1);
+  fork2(par,
+        [&] { gaepl = difference(p, gaepl1, p.left(gaep2), &reml, par - 1); },
+        [&] { gaepr = difference(p, gaepr1, p.right(gaep2), &remr, par - 1); });
+  *removed = gaepm ? join(p, reml, gaepm, remr) : join2(p, reml, remr);
+  return join2(p, gaepl, gaepr);
+}
+
+/*******************************************************
+ *
+ * Number of levels of forking to use for the given
+ * number of threads
+ *
+ *******************************************************/
+inline int fork_depth(int threads) {
+  int par;
+
+  for (par = 0; threads > 1; threads = (threads + 1) / 2)
+    par++;
+  return par;
+}
+
+/*******************************************************
+ *
+ * Add a batch of n entries to the tree. The batch is
+ * sorted in place unless sorted is set. added[i] is set
+ * to 1 if entries[i] (in sorted order) was added and to
+ * 0 if its key was already present, in the tree or
+ * earlier in the batch. Returns the number added.
+ *
+ * A batch which is large relative to the tree is merged
+ * with the tree's entries in one pass and the result
+ * relinked by build, which costs one comparison per
+ * entry and no rotations. A small batch is built into
+ * a subtree of its own and united with the tree, which
+ * costs O(m log(n/m + 1)) comparisons.
+ *
+ *******************************************************/
+template <class P>
+size_t add_batch(P& p,
+                 typename P::node_ptr* entries,
+                 size_t n,
+                 int sorted,
+                 int* added) {
+  typedef typename P::node_ptr node_ptr;
+  node_ptr last = 0;
+  node_ptr head;
+  node_ptr tail;
+  node_ptr gaep;
+  size_t count;
+  size_t m = 0;
+  size_t i;
+  int h;
+
+  /* Set up the new entries, including anything the */
+  /* policy keeps in them for comparing             */
+  for (i = 0; i < n; i++)
+    p.init(entries[i]);
+
+  if (!sorted)
+    std::stable_sort(entries, entries + n, entry_less<P>(&p));
+
+  /* Keep the first entry of each run of equal keys */
+  for (i = 0; i < n; i++) {
+    if (last && p.compare(last, p.key(entries[i])) == 0) {
+      added[i] = 0;
+      continue;
+    }
+    added[i] = 1;
+    last = entries[i];
+    m++;
+  }
+  if (m == 0)
+    return 0;
+
+  /* Adding one at a time costs about m * h compares */
+  /* against one per entry for the merge             */
+  h = height(p, p.root());
+  if (h > 0 && (h >= 62 || m * h < (size_t)1 << (h - 1))) {
+    node_ptr dups;
+
+    /* Build the batch and unite it with the tree    */
+    for (head = tail = 0, i = 0; i < n; i++) {
+      if (!added[i])
+        continue;
+      if (tail)
+        p.set_right(tail, entries[i]);
+      else
+        head = entries[i];
+      tail = entries[i];
+    }
+    list_source<P> bsrc(&p, head);
+    sub_policy<P> bp(p, 0);
+    build_sorted(bp, m, bsrc);
+    p.set_root(unite(p, p.root(), bp.root(), &dups, 0));
+
+    /* Entries left over were already in the tree    */
+    sub_policy<P> dp(p, dups);
+    gaep = flatten(dp, &count);
+    for (i = 0; gaep && i < n; i++) {
+      if (entries[i] == gaep) {
+        added[i] = 0;
+        gaep = p.right(gaep);
+        p.init(entries[i]);
+      }
+    }
+    return m - count;
+  }
+
+  /* Merge the tree's entries with the batch into a  */
+  /* single ordered list and rebuild from it         */
+  gaep = flatten(p, &count);
+  head = tail = 0;
+  for (i = 0; gaep || i < n;) {
+    node_ptr take;
+
+    if (i < n && !added[i]) {
+      i++;
+      continue;
+    }
+    if (!gaep)
+      take = entries[i++];
+    else if (i == n)
+      take = gaep;
+    else {
+      int dir = p.compare(gaep, p.key(entries[i]));
+
+      if (dir > 0)
+        take = entries[i++];
+      else {
+        if (dir == 0) {
+          /* Key is already in the tree  */
+          added[i++] = 0;
+          m--;
+        }
+        take = gaep;
+      }
+    }
+    if (take == gaep)
+      gaep = p.right(gaep);
+    if (tail)
+      p.set_right(tail, take);
+    else
+      head = take;
+    tail = take;
+  }
+
+  list_source<P> src(&p, head);
+  build_sorted(p, count + m, src);
+  return m;
+}
+
+/***********************************************************
+ *
+ * Remove the entry with the given key from the tree. If
+ * the entry is not in the tree, return 0. Otherwise, return
+ * the removed entry.
+ *
+ * This function performs an AVL tree entry removal and
+ * a balance.
+ *
+ ***********************************************************/
+template <class P>
+typename P::node_ptr unlink(P& p,
+                            stack_entry<typename P::node_ptr>* stack,
+                            stack_entry<typename P::node_ptr>* gasep,
+                            typename P::node_ptr gaep);
+
+template <class P, class K>
+typename P::node_ptr erase(P& p, const K& key) {
+  typedef typename P::node_ptr node_ptr;
+  stack_entry<node_ptr> stack[MAX_GENAVL_STACK];
+  stack_entry<node_ptr>* gasep;
+  node_ptr gaepnext;
+  node_ptr gaep = 0;
+  int dir = 0;
+
+  for (gasep = stack, gaepnext = p.root();;) {
+    if (!gaepnext)
+      return 0;
+
+    /* Push the previous entry onto the stack */
+    gasep->e = gaep;
+    gasep->d = dir;
+    gasep++;
+
+    gaep = gaepnext;
+    if ((dir = p.compare(gaepnext, key)) > 0)
+      gaepnext = p.left(gaepnext);
+    else {
+      if (dir < 0)
+        gaepnext = p.right(gaepnext);
+      else
+        break;
+    }
+
+    /* Change direction since the key is compared  */
+    /* against some entry - the compare polarity   */
+    /* is opposite the normal direction            */
+    dir = 0 - dir;
+  }
+
+  return unlink(p, stack, gasep, gaep);
+}
+
+#if defined(USE_GENAVL_PARENT)
+/***********************************************************
+ *
+ * Remove the given entry, which must be in the tree. The
+ * path that erase finds by searching is rebuilt from the
+ * parent links instead.
+ *
+ ***********************************************************/
+template <class P>
+typename P::node_ptr erase_entry(P& p, typename P::node_ptr gaep) {
+  typedef typename P::node_ptr node_ptr;
+  stack_entry<node_ptr> stack[MAX_GENAVL_STACK];
+  stack_entry<node_ptr>* gasep;
+  node_ptr gaepnext;
+  int depth = 0;
+
+  for (gaepnext = gaep; p.parent(gaepnext); gaepnext = p.parent(gaepnext))
+    depth++;
+
+  /* Fill the stack from the bottom up, as erase would */
+  /* have pushed it from the top down                  */
+  gasep = stack + depth + 1;
+  stack[0].e = 0;
+  stack[0].d = 0;
+  for (gaepnext = gaep; depth; depth--) {
+    node_ptr gaepparent = p.parent(gaepnext);
+
+    stack[depth].e = gaepparent;
+    stack[depth].d = p.left(gaepparent) == gaepnext ? -1 : 1;
+    gaepnext = gaepparent;
+  }
+
+  return unlink(p, stack, gasep, gaep);
+}
+
+/***********************************************************
+ *
+ * Return the entry following or preceding the given one
+ * by way of the child and parent links
+ *
+ ***********************************************************/
+template <class P>
+typename P::node_ptr entry_next(P& p, typename P::node_ptr gaep) {
+  typename P::node_ptr gaepnext;
+
+  if ((gaepnext = p.right(gaep))) {
+    while (p.left(gaepnext))
+      gaepnext = p.left(gaepnext);
+    return gaepnext;
+  }
+  while ((gaepnext = p.parent(gaep)) && p.right(gaepnext) == gaep)
+    gaep = gaepnext;
+  return gaepnext;
+}
+
+template <class P>
+typename P::node_ptr entry_prev(P& p, typename P::node_ptr gaep) {
+  typename P::node_ptr gaepnext;
+
+  if ((gaepnext = p.left(gaep))) {
+    while (p.right(gaepnext))
+      gaepnext = p.right(gaepnext);
+    return gaepnext;
+  }
+  while ((gaepnext = p.parent(gaep)) && p.left(gaepnext) == gaep)
+    gaep = gaepnext;
+  return gaepnext;
+}
+#endif
+
+/***********************************************************
+ *
+ * Unlink gaep from the tree and rebalance. The stack holds
+ * the path down to it: each element is an entry and the
+ * side taken from it, starting from a null entry standing
+ * for the root, with gasep just past the parent of gaep.
+ *
+ ***********************************************************/
+template <class P>
+typename P::node_ptr unlink(P& p,
+                            stack_entry<typename P::node_ptr>* stack,
+                            stack_entry<typename P::node_ptr>* gasep,
+                            typename P::node_ptr gaep) {
+  typedef typename P::node_ptr node_ptr;
+  stack_entry<node_ptr>* tempgasep;
+  node_ptr gaepnext;
+  node_ptr gaepparent;
+  int dir;
+
+  /* Swap with previous element */
+  if (p.right(gaep) && p.left(gaep)) {
+    stack_entry<node_ptr>* savegasep;
+    node_ptr saveleft;
+
+    savegasep = gasep;
+    gasep->e = gaep;
+    gasep->d = -1;
+    gasep++;
+    gaepnext = p.left(gaep);
+    while (p.right(gaepnext)) {
+      gasep->e = gaepnext;
+      gasep->d = 1;
+      gasep++;
+      gaepnext = p.right(gaepnext);
+    }
+    saveleft = p.left(gaepnext);
+    /* Swap gaep and savegaep */
+    savegasep->e = gaepnext;
+    savegasep->d = -1;
+    p.set_right(gaepnext, p.right(gaep));
+    p.set_left(gaepnext, p.left(gaep));
+    p.set_balance(gaepnext, p.balance(gaep));
+    p.set_right(gaep, 0);
+    p.set_left(gaep, saveleft);
+    /* Link it in last, as the above may have briefly  */
+    /* made gaepnext its own left child                */
+    tempgasep = savegasep - 1;
+    set(p, tempgasep->e, tempgasep->d, gaepnext);
+  }
+
+  /* Delete entry from tree */
+  gasep = gasep - 1;
+  set(p, gasep->e, gasep->d, p.right(gaep) ? p.right(gaep) : p.left(gaep));
+  for (tempgasep = gasep; tempgasep > stack; tempgasep--)
+    p.fix(tempgasep->e);
+
+  /* Go back up tree, rebalancing when necessary */
+  while (gasep > stack) {
+    gaepnext = gasep->e;
+    if (gasep->d > 0)
+      p.set_balance(gaepnext, p.balance(gaepnext) - 1);
+    else
+      p.set_balance(gaepnext, p.balance(gaepnext) + 1);
+
+    gasep = gasep - 1;
+    gaepparent = gasep->e;
+    dir = gasep->d;
+    if (p.balance(gaepnext) == 2) {
+      if (p.balance(p.right(gaepnext)) == 1)
+        shiftleft(p, gaepparent, dir);
+      else {
+        if (p.balance(p.right(gaepnext)) == -1)
+          shiftdblleft(p, gaepparent, dir);
+        else {
+          shiftleft(p, gaepparent, dir);
+          break;
+        }
+      }
+      continue;
+    } else if (p.balance(gaepnext) == -2) {
+      if (p.balance(p.left(gaepnext)) == -1)
+        shiftright(p, gaepparent, dir);
+      else {
+        if (p.balance(p.left(gaepnext)) == 1)
+          shiftdblright(p, gaepparent, dir);
+        else {
+          shiftright(p, gaepparent, dir);
+          break;
+        }
+      }
+      continue;
+    } else {
+      if (p.balance(gaepnext) == 0)
+        continue;
+      else
+        break;
+    }
+  }
+
+  return gaep;
+}
+
+}  // namespace detail
+
+/***************************************************************
+ *
+ * genavl::tree is a typed, intrusive AVL tree over objects of
+ * type T which embed a GenAVLEntry member (Hook). KeyOf is a
+ * function object returning the key of a T and Less orders two
+ * keys. Both are resolved at compile time so the comparison is
+ * inlined into the descent instead of going through the
+ * Compare and Key function pointers.
+ *
+ * The tree uses the same GenAVLEntry layout and algorithms as
+ * the C entry points and keeps the entry data pointer set to
+ * the owning object, so c_tree() can be handed to the C
+ * iterators (GenAVLDFIterInitData etc.) directly. For example:
+ *
+ * struct MyData {
+ *   int key;
+ *   GenAVLEntry hook;
+ * };
+ * struct MyKey {
+ *   const int& operator()(const MyData& d) const { return d.key; }
+ * };
+ *
+ * genavl::tree<MyData, &MyData::hook, MyKey> t;
+ * t.insert(data);
+ * MyData *found = t.find(10);
+ *
+ * KeyOf may also return the key by value, in which case the
+ * tree works on its own but c_tree() is not available.
+ *
+ * Note that, like GenAVLTree, the tree does not own its
+ * objects and does not track the number of entries.
+ *
+ ***************************************************************/
+template <class T,
+          GenAVLEntry T::*Hook,
+          class KeyOf,
+          class Less = std::less<typename std::decay<
+              decltype(std::declval<KeyOf>()(std::declval<const T&>()))>::type> >
+class tree {
+ public:
+  typedef T value_type;
+  typedef typename std::decay<decltype(
+      std::declval<KeyOf>()(std::declval<const T&>()))>::type key_type;
+
+  tree() {
+    gat_.root = 0;
+    gat_.Compare = compare_thunk;
+    gat_.Key = key_thunk_for(std::is_reference<key_result>());
+    gat_.KeyIncrement = 0;
+    gat_.KeyCompare = 0;
+#if defined(USE_GENAVL_AUGMENT)
+    gat_.Augment = 0;
+#endif
+#if defined(USE_GENAVL_PREFIX)
+    gat_.Prefix = 0;
+#endif
+  }
+
+  bool empty() const { return !gat_.root; }
+
+  /* The underlying C tree, usable with the GenAVL C calls */
+  GenAVLTree* c_tree() {
+    static_assert(std::is_reference<key_result>::value,
+                  "KeyOf must return a reference to use the C calls");
+    return &gat_;
+  }
+
+  /* Add the object, returns false if the key is already present */
+  bool insert(T& t) {
+    policy p(&gat_);
+    GenAVLEntry* e = &(t.*Hook);
+    e->data = &t;
+    return detail::add(p, e) != 0;
+  }
+
+  /* Replace the contents with n objects in ascending key order */
+  void build_sorted(T* const* objs, size_t n) {
+    policy p(&gat_);
+    object_source next(objs);
+    detail::build_sorted(p, n, next);
+  }
+
+  /* Remove and return the object with the given key or 0 */
+  T* erase(const key_type& k) {
+    policy p(&gat_);
+    return owner(detail::erase(p, k));
+  }
+
+  T* find(const key_type& k) {
+    policy p(&gat_);
+    return owner(detail::find(p, k));
+  }
+  T* first() {
+    policy p(&gat_);
+    return owner(detail::first(p));
+  }
+  T* next(const key_type& k) {
+    policy p(&gat_);
+    return owner(detail::next(p, k));
+  }
+  T* equal_next(const key_type& k) {
+    policy p(&gat_);
+    return owner(detail::equal_next(p, k));
+  }
+  T* prev(const key_type& k) {
+    policy p(&gat_);
+    return owner(detail::prev(p, k));
+  }
+  T* equal_prev(const key_type& k) {
+    policy p(&gat_);
+    return owner(detail::equal_prev(p, k));
+  }
+
+#if defined(USE_GENAVL_COUNT)
+  size_t size() const { return gat_.root ? gat_.root->count : 0; }
+
+  /* Number of objects with keys less than k */
+  size_t rank(const key_type& k) {
+    policy p(&gat_);
+    return detail::rank(p, k, 0);
+  }
+
+  /* Object at the given zero-based position or 0 */
+  T* select(size_t i) {
+    policy p(&gat_);
+    return owner(detail::select(p, i));
+  }
+#endif
+
+  /* Return the object which embeds the given entry */
+  static T* owner(GenAVLEntry* e) {
+    if (!e)
+      return 0;
+    return reinterpret_cast<T*>(reinterpret_cast<char*>(e) - hook_offset());
+  }
+
+ private:
+  tree(const tree&);
+  tree& operator=(const tree&);
+
+  static std::ptrdiff_t hook_offset() {
+    /* Offset of the hook within T, folded to a constant */
+    return reinterpret_cast<const char*>(
+               &(reinterpret_cast<const T*>(0x1000)->*Hook)) -
+           reinterpret_cast<const char*>(0x1000);
+  }
+
+  typedef decltype(std::declval<KeyOf>()(std::declval<const T&>())) key_result;
+
+  static key_result key_of(GenAVLEntry* e) {
+    return KeyOf()(*static_cast<const T*>(owner(e)));
+  }
+
+  struct policy : detail::entry_policy {
+    typedef const typename tree::key_type& key_type;
+
+    explicit policy(GenAVLTree* t) : detail::entry_policy(t) {}
+
+    key_result key(node_ptr n) const { return key_of(n); }
+    int compare(node_ptr n, key_type k) const {
+      const typename tree::key_type& nk = key_of(n);
+      if (Less()(nk, k))
+        return -1;
+      return Less()(k, nk) ? 1 : 0;
+    }
+  };
+
+  struct object_source {
+    T* const* objs;
+
+    explicit object_source(T* const* o) : objs(o) {}
+
+    GenAVLEntry* operator()() {
+      GenAVLEntry* e = &((*objs)->*Hook);
+      e->data = *objs++;
+      return e;
+    }
+  };
+
+  static int compare_thunk(GenAVLEntry* e, const void* k) {
+    policy p(0);
+    return p.compare(e, *static_cast<const key_type*>(k));
+  }
+  static void* key_thunk(GenAVLEntry* e) {
+    return const_cast<key_type*>(&key_of(e));
+  }
+
+  /* The C calls need the address of the key, which a KeyOf
+   * returning by value cannot give, so Key is left 0 then. */
+  typedef void* (*key_fn)(GenAVLEntry*);
+  static key_fn key_thunk_for(std::true_type) { return key_thunk; }
+  static key_fn key_thunk_for(std::false_type) { return 0; }
+
+  GenAVLTree gat_;
+};
+
+}  // namespace genavl
+
+#endif /* GENAVL_TREE_H */